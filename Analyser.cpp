@@ -0,0 +1,180 @@
+#include <Arduino.h>
+#include "Analyser.h"
+#include "Buttons.h"
+#include "Config.h"
+#include "Memory.h"
+
+#ifdef ANALYSER_ENABLED
+bool AnalyserCPU::OnNOOPExtension(byte Op)
+{
+  // most SysInfo writes (e.g. a delay, the control LEDs or Serial) don't change the machine so they're skipped.  A read,
+  // or loading an EEPROM page over memory, brings something in from outside so it stops the CPU (eStopExtension).
+  // The EEPROM offsets only matter to a page load, so they're skipped too.  See MCP::SystemCall()
+  if (Op == 0360)
+  {
+    byte A = m_Memory[REG_A_IDX];
+    if (A == 0xFF)
+      m_Memory[REG_A_IDX] = 0;  // extensions supported
+    return (A & 0x80) && A != (0x80 | Config::eEEPROMPage);
+  }
+  return CPU::OnNOOPExtension(Op);
+}
+
+void Analyser::Report(CPU* pCPU)
+{
+  // analyse the program in pCPU's memory, from where it is now.  pCPU isn't changed
+  pCPU->SaveState(m_Start);
+  Serial.println("[analyse");
+  PrintResult(Analyse());
+  Serial.println("]");
+}
+
+void Analyser::ReportLibrary()
+{
+  // analyse each built-in program (STOP+BitN), loaded into cleared memory
+  Serial.println("[analyse");
+  for (byte Program = 0; Program < 8; Program++)
+  {
+    m_Hare.ClearAllMemory();
+    memory.LoadStandardProgram(&m_Hare, Program);
+    m_Hare.SaveState(m_Start);
+    Serial.print("program ");
+    Serial.print(Program);
+    Serial.print(": ");
+    PrintResult(Analyse());
+  }
+  Serial.println("]");
+}
+
+byte Analyser::Analyse()
+{
+  // Brent's algorithm: the tortoise waits where the hare was after 1, 2, 4, 8... instructions until the hare comes
+  // round to it (the period is how far the hare went since), or the hare halts or reads input.  The hare is
+  // compared after every instruction, comparing after each batch would only see a period which divides into batches
+  m_Hare.RestoreState(m_Start);
+  m_Tortoise.RestoreState(m_Start);
+  unsigned long Power = 1;
+  m_Period = 0;
+  m_Step = 0;
+  for (;;)
+  {
+    word Count;
+    byte Reason = m_Hare.Run(1, Count);
+    m_Step += Count;
+    if (Reason == CPU::eStopHalt)
+      return eHalts;
+    if (Reason == CPU::eStopExtension)
+    {
+      m_Step--;   // the SYSX wasn't done
+      return eInput;
+    }
+    if (Same())
+      break;
+    if (++m_Period == Power)
+    {
+      memcpy(m_Tortoise.Memory(), m_Hare.Memory(), 256);
+      Power *= 2;
+      m_Period = 0;
+    }
+    if (m_Step % ANALYSER_BATCH == 0 && (m_Step >= ANALYSER_MAX_STEPS || Stopped()))
+      return eUnknown;
+  }
+  m_Period++;
+
+  // the cycle starts at the first step whose state is the same as Period steps later.  Run the hare Period
+  // ahead of the tortoise a batch at a time until they meet, then a step at a time from the batch before
+  unsigned long Executed;
+  m_Tortoise.RestoreState(m_Start);
+  m_Hare.RestoreState(m_Start);
+  Advance(m_Hare, m_Period, Executed);
+  m_Step = 0;
+  while (!Same())
+  {
+    Advance(m_Tortoise, ANALYSER_BATCH, Executed);
+    Advance(m_Hare, ANALYSER_BATCH, Executed);
+    m_Step += ANALYSER_BATCH;
+  }
+  if (m_Step)
+  {
+    m_Step -= ANALYSER_BATCH;
+    m_Tortoise.RestoreState(m_Start);
+    m_Hare.RestoreState(m_Start);
+    Advance(m_Tortoise, m_Step, Executed);
+    Advance(m_Hare, m_Step + m_Period, Executed);
+    while (!Same())
+    {
+      Advance(m_Tortoise, 1, Executed);
+      Advance(m_Hare, 1, Executed);
+      m_Step++;
+    }
+  }
+  return eCycle;
+}
+
+byte Analyser::Advance(AnalyserCPU& Machine, unsigned long Steps, unsigned long& Executed)
+{
+  // run exactly Steps instructions unless it halts or reads input, returns the CPU::tStopReason.  Idle stops
+  // (CPU_IDLE_DETECT) are run through, so the state after Steps only depends on the state before
+  Executed = 0;
+  while (Executed < Steps)
+  {
+    word Count;
+    byte Reason = Machine.Run((Steps - Executed > 0xFFFF)?0xFFFF:(word)(Steps - Executed), Count);
+    Executed += Count;
+    if (Reason == CPU::eStopHalt || Reason == CPU::eStopExtension)
+      return Reason;
+  }
+  return CPU::eStopBudget;
+}
+
+bool Analyser::Same()
+{
+  // are the hare and the tortoise in the same state, i.e. the same memory.  The registers are first, so
+  // different states usually differ in the first few bytes
+  for (int Addr = 0; Addr < 256; Addr++)
+  {
+    if (m_Hare.Read(Addr) != m_Tortoise.Read(Addr))
+      return false;
+  }
+  return true;
+}
+
+bool Analyser::Stopped()
+{
+  // STOP gives up
+  word State;
+  word Pressed;
+  return buttons.GetButtons(State, Pressed, false) && buttons.IsPressed(State, Buttons::eRunStop);
+}
+
+void Analyser::PrintResult(byte Result)
+{
+  // e.g. "enters a cycle of period 3 at step 0"
+  if (Result == eHalts)
+  {
+    Serial.print("halts after ");
+    Serial.print(m_Step);
+    Serial.println(" instructions");
+  }
+  else if (Result == eCycle)
+  {
+    Serial.print("enters a cycle of period ");
+    Serial.print(m_Period);
+    Serial.print(" at step ");
+    Serial.println(m_Step);
+  }
+  else if (Result == eInput)
+  {
+    Serial.print("reads external input at step ");
+    Serial.println(m_Step);
+  }
+  else
+  {
+    Serial.print("gives up after ");
+    Serial.print(m_Step);
+    Serial.println(" instructions");
+  }
+}
+
+Analyser analyser = Analyser();
+#endif
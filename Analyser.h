@@ -0,0 +1,54 @@
+#ifndef analyser_h
+#define analyser_h
+
+// define to find out whether a program halts, goes round a cycle forever or needs input, by running copies of
+// it (not for real) and reporting to Serial, see analyse.txt
+// (costs ~790 bytes of RAM, two more CPUs and the program's starting state)
+//#define ANALYSER_ENABLED
+#define ANALYSER_BATCH      256         // instructions per CPU::Run when finding where a cycle starts
+#define ANALYSER_MAX_STEPS  10000000UL  // give up after this many instructions (or when STOP is pressed)
+
+#ifdef ANALYSER_ENABLED
+#include "CPU.h"
+
+// a CPU whose SysInfo writes go nowhere and whose SysInfo reads stop it, so it depends on nothing outside
+class AnalyserCPU:public TCPU<AnalyserCPU>
+{
+public:
+  virtual bool OnNOOPExtension(byte Op);
+};
+
+// a program without input is a finite-state machine over its 256 bytes: it halts, or it repeats a state
+// and goes round a cycle.  Brent's algorithm finds the cycle, then batches of instructions find where it starts
+class Analyser
+{
+public:
+  void Report(CPU* pCPU);
+  void ReportLibrary();
+
+private:
+  enum tResult
+  {
+    eHalts,
+    eCycle,
+    eInput,
+    eUnknown
+  };
+
+  byte Analyse();
+  byte Advance(AnalyserCPU& Machine, unsigned long Steps, unsigned long& Executed);
+  bool Same();
+  bool Stopped();
+  void PrintResult(byte Result);
+
+  AnalyserCPU m_Hare;
+  AnalyserCPU m_Tortoise;   // a snapshot of the hare, then a second machine to find where the cycle starts
+  CPU::tState m_Start;      // the program, both machines are forked from it
+  unsigned long m_Step;     // when it halted, read input or started the cycle
+  unsigned long m_Period;
+};
+
+extern Analyser analyser;
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <avr/pgmspace.h>
 #include "CPU.h"
 
 // Kenbak-uino
@@ -73,34 +74,206 @@ P--           -Q-         --R
                           7 = Ind/Idx
 */
 
-#define OP_MODE_CONST      3 // or Immediate (Store)
-#define OP_MODE_MEM        4
-#define OP_MODE_INDIRECT   5
-#define OP_MODE_INDEXED    6
-#define OP_MODE_INDIND     7 
-
-#define OP_TEST_NE   3
-#define OP_TEST_EQ   4
-#define OP_TEST_LT   5
-#define OP_TEST_GE   6
-#define OP_TEST_GT   7
-
 // define to revert to 0-fill right shift and incorrect rolls of more than 1 bit
 //#define CPU_LEGACY_SHIFT_ROLL
 
 // define to revert to PC updating during opcode evaluation (vs at the end)
 //#define CPU_LEGACY_PROGRAM_COUNTER
 
-CPU* CPU::cpu = NULL;
+// define to check AluShift and AluAddSub against the original shift loops and widened add/sub, for every
+// operand (as built, with or without CPU_LEGACY_SHIFT_ROLL), at start-up.  The result goes to Serial
+//#define CPU_ALU_SELFTEST
+
+#if defined(CPU_BLOCK_CACHE) && defined(CPU_LEGACY_PROGRAM_COUNTER)
+#error "CPU_BLOCK_CACHE needs the PC to be advanced at the end of the instruction"
+#endif
+
+// The op-code decode table.  Each of the 256 op-codes is decoded once, at compile time,
+// into a word holding the class, length, register, addressing mode and "field" (see CPU.h)
+// so Execute doesn't have to pick apart P__, _Q_ & __R for every instruction.
+constexpr word DecodeEntry(byte Class, byte Length, byte Reg, byte Mode, byte Field)
+{
+  return Class | ((Length - 1) << 5) | (Reg << 6) | (Mode << 8) | (Field << 11);
+}
+
+constexpr word DecodeOpCode(byte P__, byte _Q_, byte __R)
+{
+  return
+    (__R == 0)?DecodeEntry((P__ <= 1)?CPU::eOpHalt:(_Q_ != 0)?CPU::eOpNOOPExtension:CPU::eOpNOOP, 1, 0, 0, 0):
+    (__R == 1)?DecodeEntry(CPU::eOpShiftRight + P__, 1, (_Q_ & 0x04)?REG_B_IDX:REG_A_IDX, 0, (_Q_ & 0x03)?(_Q_ & 0x03):4):
+    (__R == 2)?DecodeEntry(CPU::eOpSet0 + P__, 2, 0, OP_MODE_MEM, _Q_):
+    (_Q_ > 3) ?DecodeEntry((_Q_ & 0x02)?CPU::eOpJumpMark:CPU::eOpJump, 2, P__, (_Q_ & 0x01) + OP_MODE_CONST, (P__ == 3)?0:__R):
+    (P__ == 3)?DecodeEntry((_Q_ == 0)?CPU::eOpOr:(_Q_ == 1)?CPU::eOpNOOPExtension:(_Q_ == 2)?CPU::eOpAnd:CPU::eOpLNeg, 2, REG_A_IDX, __R, 0):
+               DecodeEntry(CPU::eOpAdd + _Q_, 2, P__, __R, 0);
+}
+
+constexpr word DecodeOpCode(byte Instruction)
+{
+  return DecodeOpCode((Instruction >> 6) & 0x03, (Instruction >> 3) & 0x07, Instruction & 0x07);
+}
+
+static_assert(DECODE_CLASS(DecodeOpCode(0360)) == CPU::eOpNOOPExtension && DECODE_LENGTH(DecodeOpCode(0360)) == 1, "SYSX decode");
+static_assert(DECODE_CLASS(DecodeOpCode(0343)) == CPU::eOpJump && DECODE_FIELD(DecodeOpCode(0343)) == 0, "JMPu decode");
+
+#define DECODE_4(_i)   DecodeOpCode(_i), DecodeOpCode(_i + 1), DecodeOpCode(_i + 2), DecodeOpCode(_i + 3)
+#define DECODE_16(_i)  DECODE_4(_i),  DECODE_4(_i + 4),   DECODE_4(_i + 8),   DECODE_4(_i + 12)
+#define DECODE_64(_i)  DECODE_16(_i), DECODE_16(_i + 16), DECODE_16(_i + 32), DECODE_16(_i + 48)
+
+const char CPU::s_ClassNames[] PROGMEM = "HALTNOOPSYSXSHR ROR SHL ROL SET0SET1SKP0SKP1JMP JMK OR  AND LNEGADD SUB LOADSTOR";
+
+const word s_DecodeTable[256] PROGMEM =
+{
+  DECODE_64(0000), DECODE_64(0100), DECODE_64(0200), DECODE_64(0300)
+};
+
+// The timing model.
+// The KENBAK-1 was bit-serial with its memory (including the registers) in recirculating shift
+// registers, so an instruction's time is dominated by the number of memory accesses it makes.
+// Each op-code is charged one memory cycle per byte read or written: P (read and written by every
+// instruction), the op-code and operand, the addressing mode's reads, and the registers and
+// result. See CPU_MEMORY_CYCLE_MICROSECONDS for the length of a cycle.
+constexpr byte CyclesOfMode(byte Mode)
+{
+  return (Mode == OP_MODE_MEM)?1:(Mode == OP_MODE_INDIRECT || Mode == OP_MODE_INDEXED)?2:(Mode == OP_MODE_INDIND)?3:0;
+}
+
+constexpr byte CyclesOfClass(byte Class, byte Field)
+{
+  return
+    (Class <= CPU::eOpNOOPExtension)?0:
+    (Class <= CPU::eOpRotateLeft)?2:                      // read & write A or B
+    (Class <= CPU::eOpSet1)?1:                            // write the byte
+    (Class <= CPU::eOpSkip1)?0:
+    (Class == CPU::eOpJump)?((Field == 0)?0:1):           // read the test register
+    (Class == CPU::eOpJumpMark)?((Field == 0)?1:2):       // and write the mark
+    (Class <= CPU::eOpAnd)?2:                             // read & write A
+    (Class == CPU::eOpLNeg)?1:
+    (Class <= CPU::eOpSub)?3:                             // read & write the register, write the flags
+                           1;                             // load or store the register
+}
+
+constexpr byte CyclesOf(word Decoded)
+{
+  return 3 + (DECODE_LENGTH(Decoded) - 1) + CyclesOfMode(DECODE_MODE(Decoded)) + CyclesOfClass(DECODE_CLASS(Decoded), DECODE_FIELD(Decoded));
+}
+
+#define CYCLES_4(_i)   CyclesOf(DecodeOpCode(_i)), CyclesOf(DecodeOpCode(_i + 1)), CyclesOf(DecodeOpCode(_i + 2)), CyclesOf(DecodeOpCode(_i + 3))
+#define CYCLES_16(_i)  CYCLES_4(_i),  CYCLES_4(_i + 4),   CYCLES_4(_i + 8),   CYCLES_4(_i + 12)
+#define CYCLES_64(_i)  CYCLES_16(_i), CYCLES_16(_i + 16), CYCLES_16(_i + 32), CYCLES_16(_i + 48)
+
+const byte s_CycleTable[256] PROGMEM =
+{
+  CYCLES_64(0000), CYCLES_64(0100), CYCLES_64(0200), CYCLES_64(0300)
+};
 
 CPU::CPU(void)
 {
-  cpu = this;
+  m_Cycles = 0;
+#ifdef CPU_BLOCK_CACHE
+  FlushBlocks();
+#endif
+#ifdef CPU_IDLE_DETECT
+  m_bIdleDirty = true;
+#endif
+#ifdef CPU_UNDO
+  m_UndoNext = m_UndoCount = 0;
+#endif
+#ifdef CPU_BREAKPOINTS
+  ClearBreakpoints();
+#endif
+}
+
+
+#ifdef CPU_ALU_SELFTEST
+static byte OriginalShift(byte Class, byte Value, byte Places)
+{
+  // the shifts & rotates as they were, a bit at a time
+  byte Rotate = (Class == CPU::eOpRotateRight || Class == CPU::eOpRotateLeft);
+  byte Left = (Class == CPU::eOpShiftLeft || Class == CPU::eOpRotateLeft);
+  byte* pValue = &Value;
+#ifndef CPU_LEGACY_SHIFT_ROLL
+  if (Left) // left
+  {
+    for (int n = 0; n < Places; n++)
+    {
+      byte Rot = *pValue & 0x80;  // grab that bit
+      *pValue <<= 1;              // shift
+      if (Rotate && Rot)          // or-in the bit that rolled off
+        *pValue |= 0x01;
+    }
+  }
+  else  // right
+  {
+    for (int n = 0; n < Places; n++)
+    {
+      byte Rot = *pValue & 0x01;  // grab that bit
+      byte Sgn = *pValue & 0x80;  // grab the "sign"
+      *pValue >>= 1;              // shift
+      if (Rotate && Rot)          // or-in the bit that rolled off
+        *pValue |= 0x80;
+      if (!Rotate && Sgn)
+        *pValue |= 0x80;          // or-in the sign
+    }
+  }
+#else
+  if (Left) // left
+  {
+    byte Rot = *pValue & 0x80;  // grab that bit
+    *pValue <<= Places;         // shift
+    if (Rotate && Rot)          // or-in the bit that rolled off
+      *pValue |= 0x01;
+  }
+  else  // right
+  {
+    byte Rot = *pValue & 0x01;  // grab that bit
+    *pValue >>= Places;         // shift
+    if (Rotate && Rot)          // or-in the bit that rolled off
+      *pValue |= 0x80;
+  }
+#endif
+  return Value;
+}
+
+static byte OriginalAddSub(byte Class, word LHS, word RHS, byte& Flags)
+{
+  // add & subtract as they were, widened to find the carry and overflow
+  word Result = (Class == CPU::eOpAdd)?LHS + RHS:LHS - RHS;
+  signed short int Temp = (Class == CPU::eOpAdd)?(signed char)LHS + (signed char)RHS:(signed char)LHS - (signed char)RHS;
+  Flags = 0;
+  if (Result & 0xFF00)
+    Flags |= 0x02; // carry (borrow)
+  if (Temp < -128 || Temp > 127)
+    Flags |= 0x01; // overflow
+  return (byte)Result;
 }
 
+static word AluSelfTest()
+{
+  // every shift/rotate of every value by 1..4 places and every add/subtract, returns the number that differ
+  word Failed = 0;
+  for (byte Class = CPU::eOpShiftRight; Class <= CPU::eOpRotateLeft; Class++)
+    for (byte Places = 1; Places <= 4; Places++)
+      for (int Value = 0; Value < 256; Value++)
+        if (CPU::AluShift(Class, Value, Places) != OriginalShift(Class, Value, Places))
+          Failed++;
+  for (byte Class = CPU::eOpAdd; Class <= CPU::eOpSub; Class++)
+    for (int LHS = 0; LHS < 256; LHS++)
+      for (int RHS = 0; RHS < 256; RHS++)
+      {
+        byte Flags, OriginalFlags;
+        if (CPU::AluAddSub(Class, LHS, RHS, Flags) != OriginalAddSub(Class, LHS, RHS, OriginalFlags) || Flags != OriginalFlags)
+          Failed++;
+      }
+  return Failed;
+}
+#endif
 
 void CPU::Init()
 {
+#ifdef CPU_ALU_SELFTEST
+  Serial.print("ALU self-test failures: ");
+  Serial.println(AluSelfTest());
+#endif
 }
 
 byte CPU::Read(byte Addr)
@@ -113,15 +286,34 @@ void CPU::Write(byte Addr, byte Value)
 {
   // set the byte at Addr
   m_Memory[Addr] = Value;
+  OnWrite(m_Memory + Addr);
 }
 
+void CPU::OnWrite(byte* pAddr)
+{
+  // called after a byte, other than the registers (A, B, X, P & their flags), is written
+#ifdef CPU_BLOCK_CACHE
+  byte Addr = pAddr - m_Memory;
+  if (bitRead(m_pCodeMap[Addr >> 3], Addr & 0x07))
+    InvalidateBlocks(Addr);
+#else
+  (void)pAddr;
+#endif
+#ifdef CPU_IDLE_DETECT
+  m_bIdleDirty = true;
+#endif
+}
 
-byte CPU::GetBitField(byte Byte, int BitNum, int NumBits)
+void CPU::OnExternalIO()
 {
-  // a helper -- get a bit field from the Byte
-  return (Byte >> BitNum) & (0xFF >> (8 - NumBits));
+  // called when an instruction (i.e. a SYSX) depended on, or changed, something outside the CPU
+  // so the program can't be idle
+#ifdef CPU_IDLE_DETECT
+  m_bIdleDirty = true;
+#endif
 }
 
+
 byte* CPU::GetAddr(byte* pByte, byte Mode)
 {
   // do the addressing modes
@@ -138,6 +330,15 @@ byte* CPU::GetAddr(byte* pByte, byte Mode)
 void CPU::ClearAllMemory()
 {
   memset(m_Memory, 0, 256);
+#ifdef CPU_BLOCK_CACHE
+  FlushBlocks();
+#endif
+#ifdef CPU_IDLE_DETECT
+  m_bIdleDirty = true;
+#endif
+#ifdef CPU_UNDO
+  m_UndoCount = 0;
+#endif
 }
 
 bool CPU::OnNOOPExtension(byte )
@@ -150,9 +351,62 @@ bool CPU::OnNOOPExtension(byte )
 byte* CPU::Memory()
 {
   // a pointer to the 256 bytes of memory
+#ifdef CPU_BLOCK_CACHE
+  FlushBlocks();  // the caller may change anything
+#endif
+#ifdef CPU_IDLE_DETECT
+  m_bIdleDirty = true;
+#endif
+#ifdef CPU_UNDO
+  m_UndoCount = 0;  // can't step back past whatever the caller does
+#endif
   return m_Memory;
 }
 
+void CPU::SaveState(tState& State)
+{
+  // copy the machine's state, e.g. to go back to it or to start another CPU from here
+  memcpy(State.m_Memory, m_Memory, sizeof(m_Memory));
+  State.m_InstructionBytes = m_InstructionBytes;
+  State.m_Cycles = m_Cycles;
+}
+
+void CPU::RestoreState(const tState& State)
+{
+  // put the machine back to a saved state, any CPU can restore any state
+  memcpy(Memory(), State.m_Memory, sizeof(m_Memory));  // via Memory(), anything may have changed
+  m_InstructionBytes = State.m_InstructionBytes;
+  m_Cycles = State.m_Cycles;
+}
+
+word CPU::Decode(byte Instruction)
+{
+  // the decoded form of the op-code, see DECODE_CLASS() etc
+  return pgm_read_word(s_DecodeTable + Instruction);
+}
+
+byte CPU::OperandAddr(byte PC)
+{
+  // the address the instruction at PC would read or write, after its addressing mode (i.e. for a jump, 
+  // the byte holding the target).  For a one byte instruction, the register it acts on (or A)
+  word Decoded = Decode(m_Memory[PC]);
+  if (DECODE_LENGTH(Decoded) == 1)
+    return DECODE_REG(Decoded);
+  return GetAddr(m_Memory + (byte)(PC + 1), DECODE_MODE(Decoded)) - m_Memory;
+}
+
+byte CPU::Cycles(byte Instruction)
+{
+  // the number of memory cycles the op-code takes on a KENBAK-1
+  return pgm_read_byte(s_CycleTable + Instruction);
+}
+
+unsigned long CPU::TotalCycles()
+{
+  // the memory cycles executed so far, see CPU_MEMORY_CYCLE_MICROSECONDS
+  return m_Cycles;
+}
+
 
 byte* CPU::GetNextByte()
 {
@@ -167,192 +421,856 @@ byte* CPU::GetNextByte()
 bool CPU::Step()
 {
   // one instruction, false means HALT
-  m_InstructionBytes = 0;
-  bool go = Execute(*GetNextByte());
-  m_Memory[REG_P_IDX] += m_InstructionBytes;  // if enabled, advance the PC at the *end* of the instruction
-  return go;
+  word Executed;
+#ifdef CPU_BREAKPOINTS
+  m_bBreakResume = true;  // a single step always executes the instruction
+  m_BreakResumePC = m_Memory[REG_P_IDX];
+#endif
+  byte Reason = Run(1, Executed);
+  return Reason == eStopBudget || Reason == eStopIdle || Reason == eStopBreakpoint;
 }
 
-bool CPU::Execute(byte Instruction)
+byte CPU::Run(word MaxInstructions, word& Executed)
 {
-  // decode/execute Instruction, false means HALT, processes the next byte if required
-  byte P__ = GetBitField(Instruction, 6, 2);
-  byte _Q_ = GetBitField(Instruction, 3, 3);
-  byte __R = GetBitField(Instruction, 0, 3);
+  // up to MaxInstructions, returns why it stopped (tStopReason), Executed is the number of instructions executed
+  bool go = true;
+#if defined(CPU_BLOCK_CACHE)
+  Executed = ExecuteBlocks(MaxInstructions, go);
+#elif defined(CPU_THREADED)
+  Executed = ExecuteThreaded(MaxInstructions, go);
+#else
+  for (Executed = 0; Executed < MaxInstructions && go; Executed++)
+  {
+#ifdef CPU_BREAKPOINTS
+    if (BreakBefore())
+      return eStopBreakpoint;
+#endif
+    m_InstructionBytes = 0;
+    go = Execute(*GetNextByte());
+    m_Memory[REG_P_IDX] += m_InstructionBytes;  // if enabled, advance the PC at the *end* of the instruction
+#ifdef CPU_BREAKPOINTS
+    if (go && BreakAfter())
+      go = false;
+#endif
+  }
+#endif
+  return go?(byte)eStopBudget:m_StopReason;
+}
 
-  if (__R == 0)  // ==================== Miscellaneous (one byte only)
+byte CPU::AluShift(byte Class, byte Value, byte Places)
+{
+  // the ALU's shifts and rotates (eOpShiftRight..eOpRotateLeft) of Value by 1..4 Places, no loops
+#ifndef CPU_LEGACY_SHIFT_ROLL
+  switch (Class)
   {
-    if (P__ == 0 || P__ == 1)  // HALT
-      return false;
-    else // NOOP
-      if (_Q_ != 0)
-        return OnNOOPExtension(Instruction);
+    case eOpShiftRight:  return (signed char)Value >> Places;             // sign-fills
+    case eOpRotateRight: return (Value >> Places) | (Value << (8 - Places));
+    case eOpShiftLeft:   return Value << Places;
+    default:             return (Value << Places) | (Value >> (8 - Places));
   }
-  else if (__R == 1)  // ==================== Shifts, Rotates (one byte only)
+#else
+  // "Legacy"
+  // rolls of more than 1 bit are incorrect.
+  // right shift is 0-filled (KENBAK-1 wasn't)
+  switch (Class)
   {
-    byte Places = _Q_ & 0x03;
-    byte Rotate = P__ & 0x01;
-    byte Left   = P__ & 0x02;
-    byte* pValue = m_Memory + ((_Q_ & 0x04)?REG_B_IDX:REG_A_IDX);
-    if (Places == 0) 
-      Places = 4;
+    case eOpShiftRight:  return Value >> Places;
+    case eOpRotateRight: return (Value >> Places) | ((Value & 0x01) << 7);
+    case eOpShiftLeft:   return Value << Places;
+    default:             return (Value << Places) | (Value >> 7);
+  }
+#endif
+}
 
-#ifndef CPU_LEGACY_SHIFT_ROLL
-    if (Left) // left
+byte CPU::AluAddSub(byte Class, byte LHS, byte RHS, byte& Flags)
+{
+  // the ALU's add or subtract (eOpAdd/eOpSub), Flags gets carry (borrow) in b1 and overflow in b0
+  byte Result;
+  if (Class == eOpAdd)
+  {
+    Result = LHS + RHS;
+    Flags = (Result < LHS)?0x02:0x00;             // carry
+    if ((LHS ^ Result) & (RHS ^ Result) & 0x80)     // operands had the same sign, the result doesn't
+      Flags |= 0x01;                                // overflow
+  }
+  else
+  {
+    Result = LHS - RHS;
+    Flags = (LHS < RHS)?0x02:0x00;                // borrow
+    if ((LHS ^ RHS) & (LHS ^ Result) & 0x80)        // operands had different signs, the result has RHS's
+      Flags |= 0x01;                                // overflow
+  }
+  return Result;
+}
+
+void CPU::ShiftRotate(word Decoded)
+{
+  // shift or rotate A or B
+  byte* pValue = m_Memory + DECODE_REG(Decoded);
+  *pValue = AluShift(DECODE_CLASS(Decoded), *pValue, DECODE_FIELD(Decoded));
+}
+
+void CPU::BitOp(word Decoded, byte* Addr)
+{
+  // set/clear or test/skip a bit at Addr
+  byte Class = DECODE_CLASS(Decoded);
+  byte Mask = 0x01 << DECODE_FIELD(Decoded);
+  byte One = (Class == eOpSet1 || Class == eOpSkip1);
+  if (Class >= eOpSkip0) // SKIP
+  {
+    byte Skip;
+    if (One)
+      Skip = *Addr & Mask;
+    else
+      Skip = !(*Addr & Mask);
+    if (Skip) // skip the next instruction (2 bytes)
+#ifdef CPU_LEGACY_PROGRAM_COUNTER
+      m_Memory[REG_P_IDX] += 2;
+#else
+      m_InstructionBytes += 2;
+#endif
+  }
+  else  // SET
+  {
+    if (One)
+      *Addr |= Mask;
+    else
+      *Addr &= ~Mask;
+    OnWrite(Addr);
+  }
+}
+
+bool CPU::JumpTaken(word Decoded, byte TestByte)
+{
+  // is the jump's condition true for its test register holding TestByte
+  byte Test = DECODE_FIELD(Decoded);
+  if (Test == 0) // unconditional
+    return true;
+  else if (Test == OP_TEST_NE)
+    return TestByte;
+  else if (Test == OP_TEST_EQ)
+    return !TestByte;
+  else if (Test == OP_TEST_LT)
+    return TestByte & 0x80;
+  else if (Test == OP_TEST_GE)
+    return !(TestByte & 0x80) || (TestByte == 0);
+  else if (Test == OP_TEST_GT)
+    return !(TestByte & 0x80) && (TestByte != 0);
+  return false;
+}
+
+bool CPU::Jump(word Decoded, byte TargetAddr)
+{
+  // conditionally jump (and mark) to TargetAddr, false if the program is idle (see CheckIdle)
+  if (JumpTaken(Decoded, m_Memory[DECODE_REG(Decoded)]))
+  {
+    byte From = m_Memory[REG_P_IDX] + m_InstructionBytes;  // the next instruction
+    if (DECODE_CLASS(Decoded) == eOpJumpMark)
     {
-      for (int n = 0; n < Places; n++)
-      {
-        byte Rot = *pValue & 0x80;  // grab that bit
-        *pValue <<= 1;              // shift
-        if (Rotate && Rot)          // or-in the bit that rolled off
-          *pValue |= 0x01;
-      }
+      m_Memory[TargetAddr] = m_Memory[REG_P_IDX] + m_InstructionBytes;
+      OnWrite(m_Memory + TargetAddr);
+      TargetAddr++;
     }
-    else  // right
+    m_Memory[REG_P_IDX] = TargetAddr;
+    m_InstructionBytes = 0;
+#ifdef CPU_IDLE_DETECT
+    if (TargetAddr < From && CheckIdle(TargetAddr))
     {
-      for (int n = 0; n < Places; n++)
-      {
-        byte Rot = *pValue & 0x01;  // grab that bit
-        byte Sgn = *pValue & 0x80;  // grab the "sign"
-        *pValue >>= 1;              // shift
-        if (Rotate && Rot)          // or-in the bit that rolled off
-          *pValue |= 0x80;
-        if (!Rotate && Sgn)
-          *pValue |= 0x80;          // or-in the sign
-      }
+      m_StopReason = eStopIdle;
+      return false;
     }
 #else
-    // "Legacy"
-    // rolls of more than 1 bit are incorrect.
-    // right shift is 0-filled (KENBAK-1 wasn't)
-    if (Left) // left
+    (void)From;
+#endif
+  }
+  return true;
+}
+
+#ifdef CPU_IDLE_DETECT
+bool CPU::CheckIdle(byte Target)
+{
+  // called after a backward jump to Target.  True if nothing has changed since the last backward jump there:
+  // P is the same, no memory other than the registers has been written (OnWrite) and the registers are
+  // the same.  So the machine is in exactly the same state and will go round again, forever.
+  // The flags can't tell if a byte was written with its old value, a loop like that is never idle.
+  byte* pRegs = m_pIdleRegs;
+  bool Same = !m_bIdleDirty && Target == m_IdleTarget;
+  for (byte Reg = REG_A_IDX; Reg <= REG_X_IDX; Reg++, pRegs += 2)
+  {
+    Same = Same && pRegs[0] == m_Memory[Reg] && pRegs[1] == m_Memory[REG_FLAGS_A_IDX + Reg];
+    pRegs[0] = m_Memory[Reg];
+    pRegs[1] = m_Memory[REG_FLAGS_A_IDX + Reg];
+  }
+  m_IdleTarget = Target;
+  m_bIdleDirty = false;
+  return Same;
+}
+#endif
+
+
+
+void CPU::AddSub(word Decoded, byte Operand)
+{
+  // add or subtract Operand, setting the register's flags
+  byte Reg = DECODE_REG(Decoded);
+  m_Memory[Reg] = AluAddSub(DECODE_CLASS(Decoded), m_Memory[Reg], Operand, m_Memory[REG_FLAGS_A_IDX + Reg]);
+}
+
+bool CPU::Execute(byte Instruction)
+{
+  // decode/execute Instruction, false means HALT, processes the next byte if required
+  word Decoded = Decode(Instruction);
+  byte* pOperand = (DECODE_LENGTH(Decoded) == 2)?GetNextByte():NULL;
+  return ExecuteDecoded(Instruction, Decoded, pOperand);
+}
+
+bool CPU::ExecuteDecoded(byte Instruction, word Decoded, byte* pOperand)
+{
+  // execute the decoded Instruction, pOperand points at the second byte if there is one
+#ifdef CPU_UNDO
+  SaveUndo(Instruction, Decoded, pOperand);
+#endif
+  m_Cycles += Cycles(Instruction);
+  switch (DECODE_CLASS(Decoded))
+  {
+    case eOpHalt:  // ==================== Miscellaneous
+      m_StopReason = eStopHalt;
+      return false;
+    case eOpNOOP:
+      break;
+    case eOpNOOPExtension:
+      if (OnNOOPExtension(Instruction))
+        break;
+      m_StopReason = eStopExtension;
+      return false;
+
+    case eOpShiftRight:  // ==================== Shifts, Rotates (one byte only)
+    case eOpRotateRight:
+    case eOpShiftLeft:
+    case eOpRotateLeft:
+      ShiftRotate(Decoded);
+      break;
+
+    case eOpSet0:  // ==================== Bit Test and Manipulation
+    case eOpSet1:
+    case eOpSkip0:
+    case eOpSkip1:
+      BitOp(Decoded, GetAddr(pOperand, OP_MODE_MEM));
+      break;
+
+    case eOpJump:  // ==================== jumps
+    case eOpJumpMark:
+      if (Jump(Decoded, *GetAddr(pOperand, DECODE_MODE(Decoded))))
+        break;
+      return false;
+
+    case eOpOr:  // ==================== Or, And, Lneg
+      m_Memory[REG_A_IDX] |= *GetAddr(pOperand, DECODE_MODE(Decoded));
+      break;
+    case eOpAnd:
+      m_Memory[REG_A_IDX] &= *GetAddr(pOperand, DECODE_MODE(Decoded));
+      break;
+    case eOpLNeg:
     {
-      byte Rot = *pValue & 0x80;  // grab that bit
-      *pValue <<= Places;         // shift
-      if (Rotate && Rot)          // or-in the bit that rolled off
-        *pValue |= 0x01;
+      signed char Temp = -(signed char)(*GetAddr(pOperand, DECODE_MODE(Decoded)));
+      m_Memory[REG_A_IDX] = (byte)Temp;
+      // flags are not set
+      break;
     }
-    else  // right
+
+    case eOpAdd:  // ==================== Add, Sub, Load, Store
+    case eOpSub:
+      AddSub(Decoded, *GetAddr(pOperand, DECODE_MODE(Decoded)));
+      break;
+    case eOpLoad:
+      m_Memory[DECODE_REG(Decoded)] = *GetAddr(pOperand, DECODE_MODE(Decoded));
+      break;
+    case eOpStore:
     {
-      byte Rot = *pValue & 0x01;  // grab that bit
-      *pValue >>= Places;         // shift
-      if (Rotate && Rot)          // or-in the bit that rolled off
-        *pValue |= 0x80;
+      byte* pAddr = GetAddr(pOperand, DECODE_MODE(Decoded));
+      *pAddr = m_Memory[DECODE_REG(Decoded)];
+      OnWrite(pAddr);
+      break;
     }
+  }
+  return true;
+}
+
+#if defined(CPU_UNDO) || defined(CPU_BREAKPOINTS)
+void CPU::GetWrites(word Decoded, byte* pOperand, byte* pAddrs)
+{
+  // the (up to 2) bytes the decoded instruction may write, REG_P_IDX means none (P is written anyway)
+  // (a SYSX is taken to write A & B)
+  byte Reg = DECODE_REG(Decoded);
+  pAddrs[0] = pAddrs[1] = REG_P_IDX;
+  switch (DECODE_CLASS(Decoded))
+  {
+    case eOpNOOPExtension:
+      pAddrs[0] = REG_A_IDX;
+      pAddrs[1] = REG_B_IDX;
+      break;
+    case eOpShiftRight:
+    case eOpRotateRight:
+    case eOpShiftLeft:
+    case eOpRotateLeft:
+    case eOpLoad:
+      pAddrs[0] = Reg;
+      break;
+    case eOpOr:
+    case eOpAnd:
+    case eOpLNeg:
+      pAddrs[0] = REG_A_IDX;
+      break;
+    case eOpAdd:
+    case eOpSub:
+      pAddrs[0] = Reg;
+      pAddrs[1] = REG_FLAGS_A_IDX + Reg;
+      break;
+    case eOpSet0:
+    case eOpSet1:
+      pAddrs[0] = GetAddr(pOperand, OP_MODE_MEM) - m_Memory;
+      break;
+    case eOpJumpMark:
+      pAddrs[0] = *GetAddr(pOperand, DECODE_MODE(Decoded));  // the mark, if the jump is taken
+      break;
+    case eOpStore:
+      pAddrs[0] = GetAddr(pOperand, DECODE_MODE(Decoded)) - m_Memory;
+      break;
+  }
+}
 #endif
+
+#ifdef CPU_UNDO
+void CPU::SaveUndo(byte Instruction, word Decoded, byte* pOperand)
+{
+  // called before an instruction executes, saves P and the bytes it may write so StepBack() can put them back
+  // (a SYSX only gets A & B back)
+  tUndo& Undo = m_pUndo[m_UndoNext];
+  m_UndoNext = (m_UndoNext + 1) % CPU_UNDO_RECORDS;
+  if (m_UndoCount < CPU_UNDO_RECORDS)
+    m_UndoCount++;
+  Undo.m_Instruction = Instruction;
+  Undo.m_P = m_Memory[REG_P_IDX] + m_InstructionBytes - DECODE_LENGTH(Decoded);  // m_InstructionBytes is 0 for the legacy PC
+  GetWrites(Decoded, pOperand, Undo.m_pAddr);
+  Undo.m_pOld[0] = m_Memory[Undo.m_pAddr[0]];
+  Undo.m_pOld[1] = m_Memory[Undo.m_pAddr[1]];
+}
+
+bool CPU::StepBack()
+{
+  // undo the last instruction, false if there are no more records
+  // Writes from outside the CPU (e.g. the Input register) aren't undone, Memory() discards the records
+  if (!m_UndoCount)
+    return false;
+  m_UndoCount--;
+  m_UndoNext = (m_UndoNext + CPU_UNDO_RECORDS - 1) % CPU_UNDO_RECORDS;
+  tUndo& Undo = m_pUndo[m_UndoNext];
+  for (int Byte = 1; Byte >= 0; Byte--)
+  {
+    m_Memory[Undo.m_pAddr[Byte]] = Undo.m_pOld[Byte];
+    OnWrite(m_Memory + Undo.m_pAddr[Byte]);
   }
-  else if (__R == 2)  // ==================== Bit Test and Manipulation
+  m_Memory[REG_P_IDX] = Undo.m_P;
+  m_Cycles -= Cycles(Undo.m_Instruction);
+  return true;
+}
+
+word CPU::Rewind(word Count)
+{
+  // step back up to Count instructions, returns the number undone
+  word Undone = 0;
+  while (Undone < Count && StepBack())
+    Undone++;
+  return Undone;
+}
+
+bool CPU::RewindToChange(byte Addr)
+{
+  // step back to just before the byte at Addr last changed, false if that's further back than the records go
+  byte Value = m_Memory[Addr];
+  while (StepBack())
   {
-    byte Mask = 0x01 << _Q_;
-    byte* Addr = GetAddr(GetNextByte(), OP_MODE_MEM);
-    byte One = P__ & 0x01;
-    if (P__ & 0x02) // SKIP
-    {
-      byte Skip;
-      if (One)
-        Skip = *Addr & Mask;
-      else
-        Skip = !(*Addr & Mask);
-      if (Skip) // skip the next instruction (2 bytes)
-#ifdef CPU_LEGACY_PROGRAM_COUNTER
-        m_Memory[REG_P_IDX] += 2;
+    if (m_Memory[Addr] != Value)
+      return true;
+  }
+  return false;
+}
+#endif
+
+#ifdef CPU_BREAKPOINTS
+void CPU::SetBreakpoint(byte Addr, byte Kinds)
+{
+  // stop at Addr on each of Kinds (tBreakKind bits, 0 clears them all).  P only takes eBreakExecute,
+  // every instruction reads & writes it
+  if (Addr == REG_P_IDX)
+    Kinds &= eBreakExecute;
+  for (byte Kind = 0; Kind < 4; Kind++)
+    bitWrite(m_pBreakMaps[Kind][Addr >> 3], Addr & 0x07, bitRead(Kinds, Kind));
+}
+
+byte CPU::GetBreakpoint(byte Addr)
+{
+  // the tBreakKind bits set at Addr
+  byte Kinds = 0;
+  for (byte Kind = 0; Kind < 4; Kind++)
+    if (bitRead(m_pBreakMaps[Kind][Addr >> 3], Addr & 0x07))
+      bitSet(Kinds, Kind);
+  return Kinds;
+}
+
+void CPU::ClearBreakpoints()
+{
+  memset(m_pBreakMaps, 0, sizeof(m_pBreakMaps));
+  m_BreakKind = m_BreakAddr = 0;
+  m_bBreakResume = false;
+}
+
+byte CPU::BreakHit(byte& Addr)
+{
+  // after eStopBreakpoint, the tBreakKind which stopped Run and Addr, the instruction's or the watched byte's address
+  Addr = m_BreakAddr;
+  return m_BreakKind;
+}
+
+bool CPU::IsBreak(byte Kind, byte Addr)
+{
+  // Kind is a single tBreakKind bit
+  byte Map = (Kind == eBreakExecute)?0:(Kind == eBreakRead)?1:(Kind == eBreakWrite)?2:3;
+  return bitRead(m_pBreakMaps[Map][Addr >> 3], Addr & 0x07);
+}
+
+bool CPU::StopAtBreak(byte Kind, byte Addr)
+{
+  m_BreakKind = Kind;
+  m_BreakAddr = Addr;
+  m_StopReason = eStopBreakpoint;
+  return true;
+}
+
+void CPU::GetReads(word Decoded, byte* pOperand, byte* pAddrs)
+{
+  // the (up to 4) bytes the decoded instruction reads, other than itself, REG_P_IDX means none
+  // a register, the indirect pointer, X if indexed and the operand
+  byte Class = DECODE_CLASS(Decoded);
+  byte Mode = (Class >= eOpSet0 && Class <= eOpSkip1)?OP_MODE_MEM:DECODE_MODE(Decoded);
+  memset(pAddrs, REG_P_IDX, 4);
+  switch (Class)
+  {
+    case eOpNOOPExtension:
+      pAddrs[0] = REG_A_IDX;
+      pAddrs[1] = REG_B_IDX;
+      return;
+    case eOpShiftRight:
+    case eOpRotateRight:
+    case eOpShiftLeft:
+    case eOpRotateLeft:
+      pAddrs[0] = DECODE_REG(Decoded);
+      return;
+    case eOpJump:
+    case eOpJumpMark:
+      if (DECODE_FIELD(Decoded))  // conditional
+        pAddrs[0] = DECODE_REG(Decoded);
+      break;
+    case eOpOr:
+    case eOpAnd:
+      pAddrs[0] = REG_A_IDX;
+      break;
+    case eOpAdd:
+    case eOpSub:
+    case eOpStore:
+      pAddrs[0] = DECODE_REG(Decoded);
+      break;
+    case eOpSet0:
+    case eOpSet1:
+    case eOpSkip0:
+    case eOpSkip1:
+    case eOpLNeg:
+    case eOpLoad:
+      break;
+    default:  // HALT, NOOP
+      return;
+  }
+  if (Mode == OP_MODE_INDIRECT || Mode == OP_MODE_INDIND)
+    pAddrs[1] = *pOperand;
+  if (Mode == OP_MODE_INDEXED || Mode == OP_MODE_INDIND)
+    pAddrs[2] = REG_X_IDX;
+  if (Mode != OP_MODE_CONST && Class != eOpStore)
+    pAddrs[3] = GetAddr(pOperand, Mode) - m_Memory;
+}
+
+bool CPU::BreakBefore()
+{
+  // called before the instruction at P, true (m_StopReason is eStopBreakpoint) if it's at an execution breakpoint
+  // or would read or write a watched byte.  The next call doesn't stop if P hasn't been changed, so Run can continue
+  // from there
+  byte PC = m_Memory[REG_P_IDX];
+  word Decoded = Decode(m_Memory[PC]);
+  byte* pOperand = m_Memory + (byte)(PC + 1);
+  GetWrites(Decoded, pOperand, m_pBreakAddr);
+  m_pBreakOld[0] = m_Memory[m_pBreakAddr[0]];
+  m_pBreakOld[1] = m_Memory[m_pBreakAddr[1]];
+  if (m_bBreakResume)
+  {
+    m_bBreakResume = false;
+    if (PC == m_BreakResumePC)
+      return false;
+  }
+  m_bBreakResume = true;
+  m_BreakResumePC = PC;
+  if (IsBreak(eBreakExecute, PC))
+    return StopAtBreak(eBreakExecute, PC);
+  byte pReads[4];
+  GetReads(Decoded, pOperand, pReads);
+  for (byte Read = 0; Read < 4; Read++)
+    if (pReads[Read] != REG_P_IDX && IsBreak(eBreakRead, pReads[Read]))
+      return StopAtBreak(eBreakRead, pReads[Read]);
+  for (byte Write = 0; Write < 2; Write++)
+    if (m_pBreakAddr[Write] != REG_P_IDX && IsBreak(eBreakWrite, m_pBreakAddr[Write]))
+      return StopAtBreak(eBreakWrite, m_pBreakAddr[Write]);
+  m_bBreakResume = false;
+  return false;
+}
+
+bool CPU::BreakAfter()
+{
+  // called after the instruction, true (m_StopReason is eStopBreakpoint) if it changed a watched byte
+  for (byte Write = 0; Write < 2; Write++)
+  {
+    byte Addr = m_pBreakAddr[Write];
+    if (m_Memory[Addr] != m_pBreakOld[Write] && IsBreak(eBreakChange, Addr))
+      return StopAtBreak(eBreakChange, Addr);
+  }
+  return false;
+}
+#endif
+
+#ifdef CPU_THREADED
+word CPU::ExecuteThreaded(word Count, bool& Go)
+{
+  // execute up to Count instructions, returns the number executed, Go is false on HALT.
+  // each handler fetches and dispatches the next instruction itself (direct threading)
+  // rather than returning to a loop. The results are identical to Step().
+  word Done = 0;
+  Go = true;
+#ifdef __GNUC__
+  // computed goto is a GNU extension. Handlers are indexed by CPU::tOpClass
+  static const void* const Handlers[] PROGMEM =
+  {
+    &&Halt, &&NOOP, &&NOOPExtension,
+    &&ShiftRotate, &&ShiftRotate, &&ShiftRotate, &&ShiftRotate,
+    &&BitOp, &&BitOp, &&BitOp, &&BitOp,
+    &&Jump, &&Jump,
+    &&Or, &&And, &&LNeg,
+    &&AddSub, &&AddSub, &&Load, &&Store
+  };
+  byte Instruction;
+  word Decoded;
+  byte* pOperand;
+
+#ifdef CPU_UNDO
+#define CPU_SAVE_UNDO() SaveUndo(Instruction, Decoded, pOperand);
 #else
-        m_InstructionBytes += 2;
+#define CPU_SAVE_UNDO()
 #endif
+
+#define CPU_DISPATCH() \
+  if (Done == Count) \
+    return Done; \
+  m_InstructionBytes = 0; \
+  Instruction = *GetNextByte(); \
+  Decoded = Decode(Instruction); \
+  pOperand = (DECODE_LENGTH(Decoded) == 2)?GetNextByte():NULL; \
+  CPU_SAVE_UNDO() \
+  m_Cycles += Cycles(Instruction); \
+  goto *pgm_read_ptr(Handlers + DECODE_CLASS(Decoded));
+
+#define CPU_NEXT() \
+  m_Memory[REG_P_IDX] += m_InstructionBytes; \
+  Done++; \
+  CPU_DISPATCH()
+
+  CPU_DISPATCH()
+
+NOOPExtension:
+  if (OnNOOPExtension(Instruction))
+  {
+    CPU_NEXT()
+  }
+  m_StopReason = eStopExtension;
+  goto Stop;
+Halt:
+  m_StopReason = eStopHalt;
+Stop:
+  m_Memory[REG_P_IDX] += m_InstructionBytes;
+  Go = false;
+  return Done + 1;
+NOOP:
+  CPU_NEXT()
+ShiftRotate:
+  ShiftRotate(Decoded);
+  CPU_NEXT()
+BitOp:
+  BitOp(Decoded, GetAddr(pOperand, OP_MODE_MEM));
+  CPU_NEXT()
+Jump:
+  if (Jump(Decoded, *GetAddr(pOperand, DECODE_MODE(Decoded))))
+  {
+    CPU_NEXT()
+  }
+  goto Stop;
+Or:
+  m_Memory[REG_A_IDX] |= *GetAddr(pOperand, DECODE_MODE(Decoded));
+  CPU_NEXT()
+And:
+  m_Memory[REG_A_IDX] &= *GetAddr(pOperand, DECODE_MODE(Decoded));
+  CPU_NEXT()
+LNeg:
+  m_Memory[REG_A_IDX] = (byte)(-(signed char)(*GetAddr(pOperand, DECODE_MODE(Decoded))));
+  CPU_NEXT()
+AddSub:
+  AddSub(Decoded, *GetAddr(pOperand, DECODE_MODE(Decoded)));
+  CPU_NEXT()
+Load:
+  m_Memory[DECODE_REG(Decoded)] = *GetAddr(pOperand, DECODE_MODE(Decoded));
+  CPU_NEXT()
+Store:
+  pOperand = GetAddr(pOperand, DECODE_MODE(Decoded));
+  *pOperand = m_Memory[DECODE_REG(Decoded)];
+  OnWrite(pOperand);
+  CPU_NEXT()
+
+#undef CPU_NEXT
+#undef CPU_DISPATCH
+#undef CPU_SAVE_UNDO
+#else
+  // portable fallback, the switch in Execute
+  while (Done < Count)
+  {
+    m_InstructionBytes = 0;
+    Go = Execute(*GetNextByte());
+    m_Memory[REG_P_IDX] += m_InstructionBytes;
+    Done++;
+    if (!Go)
+      break;
+  }
+  return Done;
+#endif
+}
+#endif
+
+#ifdef CPU_BLOCK_CACHE
+// The block cache.
+// Straight-line runs of instructions, ending at a jump, skip, HALT or extension (SYSX), are decoded
+// once and then executed from the cache.  Each block counts its executions, the coldest is evicted.  Code and data share memory so any write to a byte covered
+// by a cached block (see m_pCodeMap) discards the block.  The registers and flags are written
+// directly by the instructions, without checking the map, so they are never cached.
+#define IS_REGISTER(_a) ((_a) <= REG_P_IDX || (REG_FLAGS_A_IDX <= (_a) && (_a) <= REG_FLAGS_X_IDX))
+
+// Superinstructions.
+// The commonest pairs of instructions in the built-in programs' blocks (e.g. the STA 0200 / LDA #n / 
+// LDB #n / SYSX of a delay) are fused when a block is built: the first micro-op holds the kind in the
+// spare top bits of its m_Decoded and ExecuteFused() runs both.
+#define DECODE_FUSED(_d)  ((_d) >> 14)
+enum
+{
+  eFuseNone,
+  eFuseStoreLoad,   // STr mem, LDr #n (a register or flag isn't stored to)
+  eFuseLoads,       // LDr #n, LDr #n
+  eFuseAddStore     // ADr/SUr #n or mem, STr mem
+};
+
+word CPU::ExecuteBlocks(word Count, bool& Go)
+{
+  // execute up to Count instructions, returns the number executed, Go is false on HALT.
+  word Done = 0;
+  Go = true;
+  while (Done < Count)
+  {
+    tBlock* pBlock = FindBlock(m_Memory[REG_P_IDX]);
+    if (!pBlock)
+    {
+      // not cacheable, do it the slow way
+      m_InstructionBytes = 0;
+      Go = Execute(*GetNextByte());
+      m_Memory[REG_P_IDX] += m_InstructionBytes;
+      Done++;
+      if (!Go)
+        break;
+      continue;
     }
-    else  // SET
+
+    m_bBlocksChanged = false;
+    for (byte Op = 0; Op < pBlock->m_Ops && Done < Count; Op++)
     {
-      if (One)
-        *Addr |= Mask;
-      else
-        *Addr &= ~Mask;
+      byte PC = m_Memory[REG_P_IDX];
+      tMicroOp& MicroOp = pBlock->m_pOps[Op];
+      if (DECODE_FUSED(MicroOp.m_Decoded) && Count - Done >= 2)
+      {
+        Done += ExecuteFused(&MicroOp, PC);
+        Op++;
+        if (m_bBlocksChanged)
+          break;
+        continue;
+      }
+      byte Length = DECODE_LENGTH(MicroOp.m_Decoded);
+      m_InstructionBytes = Length;
+      Go = ExecuteDecoded(MicroOp.m_Instruction, MicroOp.m_Decoded, m_Memory + (byte)(PC + 1));
+      m_Memory[REG_P_IDX] += m_InstructionBytes;
+      Done++;
+      if (!Go)
+        return Done;
+      if (m_bBlocksChanged || m_Memory[REG_P_IDX] != (byte)(PC + Length))
+        break;  // the block over-wrote itself, or P
     }
   }
-  else if (_Q_ > 3)    // ==================== jumps
+  return Done;
+}
+
+CPU::tBlock* CPU::FindBlock(byte Addr)
+{
+  // the cached block starting at Addr, built if necessary. NULL if it can't be cached
+  // The block executed least often recently is replaced, so the hot loops stay cached
+  tBlock* pColdest = m_pBlocks;
+  for (byte Block = 0; Block < CPU_BLOCK_CACHE_BLOCKS; Block++)
   {
-    byte JumpAndMark = _Q_ & 0x02;
-    byte AddressMode = (_Q_ & 0x01) + OP_MODE_CONST;
-    byte TestByte = m_Memory[P__];
-    byte Condition = 0;
-    byte TargetAddr = *GetAddr(GetNextByte(), AddressMode);
-
-    if (P__ == 3)
-      Condition = 1;
-    else if (__R == OP_TEST_NE)
-      Condition = TestByte;
-    else if (__R == OP_TEST_EQ)
-      Condition = !TestByte;
-    else if (__R == OP_TEST_LT)
-      Condition = TestByte & 0x80;
-    else if (__R == OP_TEST_GE)
-      Condition = !(TestByte & 0x80) || (TestByte == 0);
-    else if (__R == OP_TEST_GT)
-      Condition = !(TestByte & 0x80) && (TestByte != 0);
-
-    if (Condition)
+    tBlock* pBlock = m_pBlocks + Block;
+    if (pBlock->m_Ops && pBlock->m_Start == Addr)
     {
-      if (JumpAndMark)
+      if (++pBlock->m_Hits == 0xFF)
       {
-        m_Memory[TargetAddr] = m_Memory[REG_P_IDX] + m_InstructionBytes;
-        TargetAddr++;
+        // age them all
+        for (Block = 0; Block < CPU_BLOCK_CACHE_BLOCKS; Block++)
+          m_pBlocks[Block].m_Hits >>= 1;
       }
-      m_Memory[REG_P_IDX] = TargetAddr;
-      m_InstructionBytes = 0;
+      return pBlock;
     }
+    if (!pBlock->m_Ops || (pColdest->m_Ops && pBlock->m_Hits < pColdest->m_Hits))
+      pColdest = pBlock;
   }
-  else if (P__ == 3)  // ==================== Or, And, Lneg, Noop
+
+  if (pColdest->m_Ops)
+    InvalidateBlocks(pColdest->m_Start);  // evict it
+  if (!BuildBlock(pColdest, Addr))
+    return NULL;
+  return pColdest;
+}
+
+bool CPU::BuildBlock(tBlock* pBlock, byte Addr)
+{
+  // decode the instructions starting at Addr into pBlock, false if there are none
+  int End = Addr;
+  byte Fuse = eFuseNone;  // the kind the previous micro-op could start, if it isn't fused already
+  pBlock->m_Start = Addr;
+  pBlock->m_Ops = 0;
+  pBlock->m_Hits = 0;
+  while (pBlock->m_Ops < CPU_BLOCK_CACHE_OPS)
   {
-    byte* regA = m_Memory + REG_A_IDX;
-    byte* operand = GetAddr(GetNextByte(), __R);
-    if (_Q_ == 0)  // OR
-      *regA |= *operand;
-    else if (_Q_ == 1) // (NOOP)
-      return OnNOOPExtension(Instruction);
-    else if (_Q_ == 2) // AND
-      *regA &= *operand;
-    else if (_Q_ == 3) // LNEG
+    byte Instruction = m_Memory[End];
+    word Decoded = Decode(Instruction);
+    byte Length = DECODE_LENGTH(Decoded);
+    if (End + Length > 0400 || IS_REGISTER(End) || (Length == 2 && IS_REGISTER(End + 1)))
+      break;  // don't wrap around or cache the registers
+    byte Class = DECODE_CLASS(Decoded);
+    byte Mode = DECODE_MODE(Decoded);
+    byte Operand = m_Memory[(byte)(End + 1)];
+    if (Class == eOpLoad && Mode == OP_MODE_CONST && (Fuse == eFuseStoreLoad || Fuse == eFuseLoads))
     {
-      signed char Temp = -(signed char)(*operand);
-      *regA = (byte)Temp;
-      // flags are not set
+      pBlock->m_pOps[pBlock->m_Ops - 1].m_Decoded |= Fuse << 14;
+      Fuse = eFuseNone;
     }
-  }
-  else  // ==================== Add, Sub, Load, Store
-  {
-    byte* pLHS = m_Memory + P__;
-    byte* pFlags = m_Memory + REG_FLAGS_A_IDX + P__;
-    byte* pRHS = GetAddr(GetNextByte(), __R);
-    word LHS = *pLHS;
-    word RHS = *pRHS;
-    word Result;
-    if (_Q_ == 0) // ADD
+    else if (Class == eOpStore && Mode == OP_MODE_MEM && !IS_REGISTER(Operand) && Fuse == eFuseAddStore)
     {
-      Result = LHS + RHS;
-      *pLHS = (byte)Result;
-      *pFlags = 0;
-      if (Result & 0xFF00)
-        *pFlags |= 0x02; // carry
-
-      signed short int Temp = (signed char)LHS + (signed char)RHS;
-      if (Temp < -128 || Temp > 127)
-        *pFlags |= 0x01; // overflow
+      pBlock->m_pOps[pBlock->m_Ops - 1].m_Decoded |= Fuse << 14;
+      Fuse = eFuseNone;
     }
-    else if (_Q_ == 1)  // SUB
+    else if (Class == eOpStore && Mode == OP_MODE_MEM && !IS_REGISTER(Operand))
+      Fuse = eFuseStoreLoad;
+    else if (Class == eOpLoad && Mode == OP_MODE_CONST)
+      Fuse = eFuseLoads;
+    else if ((Class == eOpAdd || Class == eOpSub) && (Mode == OP_MODE_CONST || Mode == OP_MODE_MEM))
+      Fuse = eFuseAddStore;
+    else
+      Fuse = eFuseNone;
+    pBlock->m_pOps[pBlock->m_Ops].m_Instruction = Instruction;
+    pBlock->m_pOps[pBlock->m_Ops].m_Decoded = Decoded;
+    pBlock->m_Ops++;
+    for (byte Byte = 0; Byte < Length; Byte++, End++)
+      bitSet(m_pCodeMap[End >> 3], End & 0x07);
+    if (Class == eOpHalt || Class == eOpNOOPExtension || Class == eOpJump || Class == eOpJumpMark || Class == eOpSkip0 || Class == eOpSkip1)
+      break;  // end of the block
+  }
+  pBlock->m_Bytes = End - Addr;
+  return pBlock->m_Ops != 0;
+}
+
+byte CPU::ExecuteFused(const tMicroOp* pOps, byte PC)
+{
+  // execute the fused pair of (2 byte) micro-ops at PC, as ExecuteDecoded would one after the other.
+  // Returns the number executed, 1 if the first wrote over the block
+  word First = pOps[0].m_Decoded;
+  byte Fused = DECODE_FUSED(First);
+  byte* pOperand = m_Memory + (byte)(PC + 1);
+  m_InstructionBytes = 2;
+#ifdef CPU_UNDO
+  SaveUndo(pOps[0].m_Instruction, First, pOperand);
+#endif
+  m_Cycles += Cycles(pOps[0].m_Instruction);
+  if (Fused == eFuseStoreLoad)
+  {
+    m_Memory[*pOperand] = m_Memory[DECODE_REG(First)];
+    OnWrite(m_Memory + *pOperand);
+  }
+  else if (Fused == eFuseLoads)
+    m_Memory[DECODE_REG(First)] = *pOperand;
+  else
+    AddSub(First, *GetAddr(pOperand, DECODE_MODE(First)));
+  m_Memory[REG_P_IDX] += 2;
+  if (m_bBlocksChanged)
+    return 1;
+
+  word Second = pOps[1].m_Decoded;
+  pOperand += 2;
+#ifdef CPU_UNDO
+  SaveUndo(pOps[1].m_Instruction, Second, pOperand);
+#endif
+  m_Cycles += Cycles(pOps[1].m_Instruction);
+  if (Fused == eFuseAddStore)
+  {
+    m_Memory[*pOperand] = m_Memory[DECODE_REG(Second)];
+    OnWrite(m_Memory + *pOperand);
+  }
+  else
+    m_Memory[DECODE_REG(Second)] = *pOperand;
+  m_Memory[REG_P_IDX] += 2;
+  return 2;
+}
+
+void CPU::InvalidateBlocks(byte Addr)
+{
+  // discard any blocks covering Addr and rebuild the code map
+  memset(m_pCodeMap, 0, sizeof(m_pCodeMap));
+  for (byte Block = 0; Block < CPU_BLOCK_CACHE_BLOCKS; Block++)
+  {
+    tBlock& Cached = m_pBlocks[Block];
+    if (!Cached.m_Ops)
+      continue;
+    if (Cached.m_Start <= Addr && Addr < Cached.m_Start + Cached.m_Bytes)
     {
-      Result = LHS - RHS;
-      *pLHS = (byte)Result;
-      *pFlags = 0;
-      if (Result & 0xFF00)
-        *pFlags |= 0x02; // carry (borrow)
-
-      signed short int Temp = (signed char)LHS - (signed char)RHS;
-      if (Temp < -128 || Temp > 127)
-        *pFlags |= 0x01; // overflow
+      Cached.m_Ops = 0;
+      continue;
     }
-    else if (_Q_ == 2)  // LOAD
-      *pLHS = *pRHS; 
-    else if (_Q_ == 3)  // STORE
-      *pRHS = *pLHS;
+    for (int Byte = Cached.m_Start; Byte < Cached.m_Start + Cached.m_Bytes; Byte++)
+      bitSet(m_pCodeMap[Byte >> 3], Byte & 0x07);
   }
-  return true;
+  m_bBlocksChanged = true;
 }
+
+void CPU::FlushBlocks()
+{
+  // discard all the cached blocks
+  for (byte Block = 0; Block < CPU_BLOCK_CACHE_BLOCKS; Block++)
+    m_pBlocks[Block].m_Ops = 0;
+  memset(m_pCodeMap, 0, sizeof(m_pCodeMap));
+  m_bBlocksChanged = true;
+}
+#endif
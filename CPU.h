@@ -3,6 +3,36 @@
 
 // emulates the KENBAK-1 "cpu"
 
+// define to run instructions with the threaded interpreter (ExecuteThreaded) rather than Execute's switch
+// it still fetches and decodes each instruction, its handlers are per op-code class not per address (that would
+// cost 512 bytes of RAM), so it's only ~10-80% faster than Run's loop on a host build, depending on the program
+//#define CPU_THREADED
+
+// define to cache decoded straight-line blocks of instructions (costs ~140 bytes of RAM)
+// frequent pairs of instructions in a block are fused and executed as one, see CPU::ExecuteFused()
+//#define CPU_BLOCK_CACHE
+#define CPU_BLOCK_CACHE_BLOCKS  4   // number of blocks cached
+#define CPU_BLOCK_CACHE_OPS     8   // maximum instructions per block
+
+// define to stop Run (eStopIdle) when a program is provably looping without changing anything,
+// e.g. a jump to itself or polling the input register
+//#define CPU_IDLE_DETECT
+
+// define to keep undo records of the last few instructions so they can be stepped back (costs 6 bytes of RAM each)
+//#define CPU_UNDO
+#define CPU_UNDO_RECORDS 32
+
+// define to stop Run (eStopBreakpoint) at execution breakpoints and read/write/change watchpoints, see SetBreakpoint()
+// (costs 135 bytes of RAM and a check of each instruction, needs the plain interpreter)
+//#define CPU_BREAKPOINTS
+
+#if defined(CPU_BREAKPOINTS) && (defined(CPU_THREADED) || defined(CPU_BLOCK_CACHE))
+#error CPU_BREAKPOINTS is checked by Run's loop, it can't be used with CPU_THREADED or CPU_BLOCK_CACHE
+#endif
+
+// the length of a KENBAK-1 memory cycle, see CPU::Cycles().  A typical instruction (e.g. LDA memory)
+// takes 6 cycles, about 1ms; the original is quoted as running a little under 1000 instructions/second
+#define CPU_MEMORY_CYCLE_MICROSECONDS 160
 
 #define REG_A_IDX       000
 #define REG_B_IDX       001
@@ -15,31 +45,254 @@
 #define REG_FLAGS_X_IDX 0203
 #define REG_INPUT_IDX   0377
 
+// fields of a decoded op-code, see CPU::Decode()
+#define DECODE_CLASS(_d)    ((_d) & 0x1F)               // CPU::tOpClass
+#define DECODE_LENGTH(_d)   ((((_d) >> 5) & 0x01) + 1)  // 1 or 2 bytes
+#define DECODE_REG(_d)      (((_d) >> 6) & 0x03)        // A/B/X/P register (or the jump's test register)
+#define DECODE_MODE(_d)     (((_d) >> 8) & 0x07)        // addressing mode
+#define DECODE_FIELD(_d)    (((_d) >> 11) & 0x07)       // bit number, shift places or jump condition (0 = unconditional)
+
+// addressing modes, DECODE_MODE()
+#define OP_MODE_CONST      3 // or Immediate (Store)
+#define OP_MODE_MEM        4
+#define OP_MODE_INDIRECT   5
+#define OP_MODE_INDEXED    6
+#define OP_MODE_INDIND     7 
+
+// jump conditions, DECODE_FIELD() of a jump
+#define OP_TEST_NE   3
+#define OP_TEST_EQ   4
+#define OP_TEST_LT   5
+#define OP_TEST_GE   6
+#define OP_TEST_GT   7
 
 class CPU
 {
 public:
+  enum tOpClass
+  {
+    eOpHalt,
+    eOpNOOP,
+    eOpNOOPExtension,
+    eOpShiftRight,  // these 4 are in "P" order
+    eOpRotateRight,
+    eOpShiftLeft,
+    eOpRotateLeft,
+    eOpSet0,        // these 4 are in "P" order
+    eOpSet1,
+    eOpSkip0,
+    eOpSkip1,
+    eOpJump,
+    eOpJumpMark,
+    eOpOr,
+    eOpAnd,
+    eOpLNeg,
+    eOpAdd,         // these 4 are in "Q" order
+    eOpSub,
+    eOpLoad,
+    eOpStore
+  };
+
+  enum tStopReason
+  {
+    eStopBudget,      // executed the maximum number of instructions
+    eStopHalt,        // HALT instruction
+    eStopExtension,   // OnNOOPExtension returned false (e.g. STOP pressed during a SYSX delay)
+    eStopIdle,        // looping forever unless something external changes, see CPU_IDLE_DETECT
+    eStopBreakpoint   // hit a breakpoint or watchpoint, see CPU_BREAKPOINTS
+  };
+
+  // what a breakpoint stops on, see SetBreakpoint()
+  enum tBreakKind
+  {
+    eBreakExecute = 0x01,   // before the instruction at the address
+    eBreakRead    = 0x02,   // before an instruction reads the byte
+    eBreakWrite   = 0x04,   // before an instruction writes the byte
+    eBreakChange  = 0x08    // after an instruction changes the byte
+  };
+
+  // the complete state of the machine, see SaveState()
+  struct tState
+  {
+    byte m_Memory[256];
+    byte m_InstructionBytes;
+    unsigned long m_Cycles;
+  };
+
   CPU(void);
 
   virtual void Init();
   virtual bool Step();
+  virtual byte Run(word MaxInstructions, word& Executed);
   byte Read(byte Addr);
   void Write(byte Addr, byte Value);
   void ClearAllMemory();
   virtual bool OnNOOPExtension(byte Op);
+  void OnExternalIO();
 
   byte* Memory();
+  void SaveState(tState& State);
+  void RestoreState(const tState& State);
+#ifdef CPU_UNDO
+  bool StepBack();
+  word Rewind(word Count);
+  bool RewindToChange(byte Addr);
+#endif
+#ifdef CPU_BREAKPOINTS
+  void SetBreakpoint(byte Addr, byte Kinds);
+  byte GetBreakpoint(byte Addr);
+  void ClearBreakpoints();
+  byte BreakHit(byte& Addr);
+#endif
+  static word Decode(byte Instruction);
+  byte OperandAddr(byte PC);
+  static byte Cycles(byte Instruction);
+  unsigned long TotalCycles();
+  static byte AluShift(byte Class, byte Value, byte Places);
+  static byte AluAddSub(byte Class, byte LHS, byte RHS, byte& Flags);
+  static bool JumpTaken(word Decoded, byte TestByte);
 
-  static CPU* cpu;
+  static const char s_ClassNames[];   // in PROGMEM, 4 characters per tOpClass
 
-private:
-  byte GetBitField(byte Byte, int BitNum, int NumBits);
-  byte* GetAddr(byte* pByte, byte Mode);
+protected:
   byte* GetNextByte();
-  bool Execute(byte Instruction);
+  bool ExecuteDecoded(byte Instruction, word Decoded, byte* pOperand);
+#if defined(CPU_UNDO) || defined(CPU_BREAKPOINTS)
+  void GetWrites(word Decoded, byte* pOperand, byte* pAddrs);
+#endif
+#ifdef CPU_UNDO
+  void SaveUndo(byte Instruction, word Decoded, byte* pOperand);
+#endif
+#ifdef CPU_BREAKPOINTS
+  bool BreakBefore();
+  bool BreakAfter();
+#endif
 
   byte m_Memory[256];
   byte m_InstructionBytes = 0;
+  byte m_StopReason;
+  unsigned long m_Cycles;
+
+private:
+  byte* GetAddr(byte* pByte, byte Mode);
+  bool Execute(byte Instruction);
+  word ExecuteThreaded(word Count, bool& Go);
+  word ExecuteBlocks(word Count, bool& Go);
+  void OnWrite(byte* pAddr);
+  void ShiftRotate(word Decoded);
+  void BitOp(word Decoded, byte* Addr);
+  bool Jump(word Decoded, byte TargetAddr);
+  void AddSub(word Decoded, byte Operand);
+
+#ifdef CPU_BLOCK_CACHE
+  struct tMicroOp
+  {
+    byte m_Instruction;
+    word m_Decoded;
+  };
+  struct tBlock
+  {
+    byte m_Start;   // address of the first instruction
+    byte m_Bytes;   // bytes covered
+    byte m_Ops;     // instructions, 0 means the block is empty
+    byte m_Hits;    // times executed, halved when any block's count saturates
+    tMicroOp m_pOps[CPU_BLOCK_CACHE_OPS];
+  };
+  tBlock* FindBlock(byte Addr);
+  bool BuildBlock(tBlock* pBlock, byte Addr);
+  void InvalidateBlocks(byte Addr);
+  void FlushBlocks();
+  byte ExecuteFused(const tMicroOp* pOps, byte PC);
+
+  tBlock m_pBlocks[CPU_BLOCK_CACHE_BLOCKS];
+  byte m_pCodeMap[256/8];   // bit set for each byte covered by a cached block
+  bool m_bBlocksChanged;
+#endif
+#ifdef CPU_UNDO
+  // what an instruction changed: P and up to two bytes
+  struct tUndo
+  {
+    byte m_Instruction;   // for its cycles
+    byte m_P;
+    byte m_pAddr[2];
+    byte m_pOld[2];
+  };
+  tUndo m_pUndo[CPU_UNDO_RECORDS];
+  byte m_UndoNext;    // where the next record goes
+  byte m_UndoCount;   // records available to step back
+#endif
+#ifdef CPU_IDLE_DETECT
+  bool CheckIdle(byte Target);
+
+  bool m_bIdleDirty;      // memory other than the registers was written, or there was I/O, since the snapshot
+  byte m_IdleTarget;      // the snapshot: the target of the backward jump
+  byte m_pIdleRegs[6];    // and A, B, X & their flags
+#endif
+#ifdef CPU_BREAKPOINTS
+  void GetReads(word Decoded, byte* pOperand, byte* pAddrs);
+  bool IsBreak(byte Kind, byte Addr);
+  bool StopAtBreak(byte Kind, byte Addr);
+
+  byte m_pBreakMaps[4][256/8];  // bit set for each address, by tBreakKind
+  byte m_pBreakAddr[2];         // what the instruction may write, REG_P_IDX for nothing
+  byte m_pBreakOld[2];          // and their values before it
+  byte m_BreakKind;             // what was hit
+  byte m_BreakAddr;
+  bool m_bBreakResume;          // the last Run stopped before the instruction at m_BreakResumePC, don't stop there again
+  byte m_BreakResumePC;
+#endif
+};
+
+// A CPU with the NOOP extension handler bound at compile time (CRTP).
+// Derived::OnNOOPExtension is called directly from Run's loop, so it can be inlined and there
+// are no virtual calls per instruction.  The virtual Step/Run/OnNOOPExtension remain for callers
+// which only know about CPU (e.g. MCP).
+// The threaded and block cache interpreters call OnNOOPExtension virtually, they're used if configured.
+template <class Derived>
+class TCPU:public CPU
+{
+public:
+  virtual byte Run(word MaxInstructions, word& Executed)
+  {
+#if defined(CPU_BLOCK_CACHE) || defined(CPU_THREADED)
+    return CPU::Run(MaxInstructions, Executed);
+#else
+    for (Executed = 0; Executed < MaxInstructions; Executed++)
+    {
+#ifdef CPU_BREAKPOINTS
+      if (BreakBefore())
+        return eStopBreakpoint;
+#endif
+      m_InstructionBytes = 0;
+      byte Instruction = *GetNextByte();
+      word Decoded = Decode(Instruction);
+      byte* pOperand = (DECODE_LENGTH(Decoded) == 2)?GetNextByte():NULL;
+      bool go;
+      if (DECODE_CLASS(Decoded) == eOpNOOPExtension)
+      {
+#ifdef CPU_UNDO
+        SaveUndo(Instruction, Decoded, pOperand);
+#endif
+        m_Cycles += Cycles(Instruction);
+        go = static_cast<Derived*>(this)->Derived::OnNOOPExtension(Instruction);
+        m_StopReason = eStopExtension;
+      }
+      else
+        go = ExecuteDecoded(Instruction, Decoded, pOperand);
+      m_Memory[REG_P_IDX] += m_InstructionBytes;
+#ifdef CPU_BREAKPOINTS
+      if (go && BreakAfter())
+        go = false;
+#endif
+      if (!go)
+      {
+        Executed++;
+        return m_StopReason;
+      }
+    }
+    return eStopBudget;
+#endif
+  }
 };
 
 #endif
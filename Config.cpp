@@ -3,17 +3,22 @@
 #pragma GCC diagnostic ignored "-Wignored-qualifiers"
 #include <EEPROM.h>
 #pragma GCC diagnostic pop
+#include <avr/pgmspace.h>
 #include "Config.h"
 #include "MCP.h"
 #include "Buttons.h"
 #include "Clock.h"
 #include "Memory.h"
+#include "Recorder.h"
+#include "Tracer.h"
 
 
-#define TOGGLE_BITS_FLAG 0x01
+#define TOGGLE_BITS_FLAG      0x01
+#define HISTORICAL_SPEED_FLAG 0x02
 
 Config::Config():
   m_bToggleBits(true),
+  m_bHistoricalSpeed(false),
   m_iCycleDelayMilliseconds(0),
   m_iEEPROMSlotMap(0x0A),
   m_iAutoRunProgram(0)
@@ -32,9 +37,25 @@ void Config::Init()
   m_iAutoRunProgram = Read(eControlAutoRun);
 }
 
-byte Config::Read(byte Item, byte Value)
+byte Config::Read(byte Item, byte Value, CPU* pCPU)
+{
+  // read the SysInfo item with the given index, pCPU is the machine making the call (if any)
+#ifdef RECORDER_ENABLED
+  if (Item <= eControlSerial && Item != eControlLEDs && Item != eControlDelayMilliSec)
+  {
+    // from outside the CPU: the RTC, random or serial.  When replaying, the recorded value without touching them,
+    // unless the program has gone a different way and the replay has been given up
+    byte Recorded;
+    if (recorder.Replayed(Item, Recorded))
+      return Recorded;
+    return recorder.Input(Item, ReadItem(Item, Value, pCPU));
+  }
+#endif
+  return ReadItem(Item, Value, pCPU);
+}
+
+byte Config::ReadItem(byte Item, byte Value, CPU* pCPU)
 {
-  // read the SysInfo item with the given index
   switch (Item)
   {
     case eClockSeconds:
@@ -104,14 +125,14 @@ byte Config::Read(byte Item, byte Value)
     case eEEPROMOverlay:
       return m_EEPROMOffset;
     case eEEPROMPage:
-      return ReadFromEEPROM(true, Value);
+      return ReadFromEEPROM(pCPU, true, Value);
   }
   return 0;
 }
 
-bool Config::Write(byte Item, byte Value)
+bool Config::Write(byte Item, byte Value, CPU* pCPU)
 {
-  // write the SysInfo item with the given index
+  // write the SysInfo item with the given index, pCPU is the machine making the call (if any)
   // false means HALT
   switch (Item)
   {
@@ -208,6 +229,14 @@ bool Config::Write(byte Item, byte Value)
     }
     case eControlSerial:
     {
+#ifdef RECORDER_ENABLED
+      if (recorder.Output(0x80 | Item, Value))
+        break;  // Serial is carrying the recording, the output is recorded (or checked against it) instead
+#endif
+#ifdef TRACER_ENABLED
+      if (tracer.Active())
+        break;  // Serial is carrying the trace, the output would break up its records
+#endif
       Serial.write(Value);
       break;
     }
@@ -225,23 +254,41 @@ bool Config::Write(byte Item, byte Value)
       m_EEPROMSize = 256 - Value;
       break;
     case eEEPROMPage:
-      ReadFromEEPROM(false, Value);
+      ReadFromEEPROM(pCPU, false, Value);
       break;
   }
   return true;
 }
 
+void Config::SaveState(tState& State)
+{
+  State.m_EEPROMOffset = m_EEPROMOffset;
+  State.m_RAMOffset = m_RAMOffset;
+  State.m_EEPROMSize = m_EEPROMSize;
+}
+
+void Config::RestoreState(const tState& State)
+{
+  m_EEPROMOffset = State.m_EEPROMOffset;
+  m_RAMOffset = State.m_RAMOffset;
+  m_EEPROMSize = State.m_EEPROMSize;
+}
+
+// the CPU Speed delays for Bit0..Bit7, 1000 down to 1 instructions per second
+static const word s_CPUSpeedDelays[8] PROGMEM = { 1, 2, 5, 10, 50, 100, 500, 1000 };
+
 void Config::SetCPUSpeed(byte Bit)
 {
-  // 2^N: 1ms..128ms
+  // 1ms..1000ms, see s_CPUSpeedDelays
   // Wikipedia says "...actual execution speed averaged below 1000 instructions per second..." 
-  m_iCycleDelayMilliseconds = 1 << Bit;
+  m_iCycleDelayMilliseconds = pgm_read_word(s_CPUSpeedDelays + Bit);
 }
 
 
 void Config::UpdateFlags(byte Value)
 {
   m_bToggleBits = (Value & TOGGLE_BITS_FLAG) == TOGGLE_BITS_FLAG;
+  m_bHistoricalSpeed = (Value & HISTORICAL_SPEED_FLAG) == HISTORICAL_SPEED_FLAG;
 }
 
 void Config::CheckStartupConfig()
@@ -280,9 +327,11 @@ void Config::CheckStartupConfig()
   }
 }
 
-byte Config::ReadFromEEPROM(bool Read, byte EEPROMPage)
+byte Config::ReadFromEEPROM(CPU* pCPU, bool Read, byte EEPROMPage)
 {
-  // Reads bytes from EEPROM into RAM or vice-versa
+  // Reads bytes from EEPROM into pCPU's RAM or vice-versa
+  if (!pCPU)
+    return EEPROMPage;
   int slot = EEPROMPage & 0b00000111;
   bool preserve = EEPROMPage & COPY_EEPROM_PRESERVE;
   int ramSize = m_EEPROMSize;
@@ -306,12 +355,12 @@ byte Config::ReadFromEEPROM(bool Read, byte EEPROMPage)
       bool reserved = (ramIdx <= REG_P_IDX || (REG_OUTPUT_IDX <= ramIdx && ramIdx <= REG_FLAGS_X_IDX) || ramIdx == REG_INPUT_IDX);
       if (!preserve || !reserved)
       {
-        CPU::cpu->Write(ramIdx, EEPROM.read(eepromIdx));
+        pCPU->Write(ramIdx, EEPROM.read(eepromIdx));
       }
     }
     else
     {
-      EEPROM.write(eepromIdx, CPU::cpu->Read(ramIdx));
+      EEPROM.write(eepromIdx, pCPU->Read(ramIdx));
     }
     ramIdx++;
     eepromIdx++;
@@ -10,6 +10,8 @@
 #define COPY_EEPROM_PRESERVE  0b00010000  // preserve special locations
 #define COPY_EEPROM_PAGE      0b00001000  // a page is 256 bytes not slots
 
+class CPU;
+
 class Config
 {
 public:
@@ -48,23 +50,36 @@ public:
     eEEPROMPage
   };
   
+  // the SysInfo EEPROM copy settings, part of a program's state, see Recorder::Record().  There's one config, so
+  // CPUs forked from a CPU::tState share them
+  struct tState
+  {
+    byte m_EEPROMOffset;
+    byte m_RAMOffset;
+    int m_EEPROMSize;
+  };
+
   Config();
   void Init();
   
-  byte Read(byte Item, byte Value=0);
-  bool Write(byte Item, byte Value);
+  byte Read(byte Item, byte Value=0, CPU* pCPU=NULL);
+  bool Write(byte Item, byte Value, CPU* pCPU=NULL);
   void SetCPUSpeed(byte Bit);
+  void SaveState(tState& State);
+  void RestoreState(const tState& State);
   
   // configuration settings
   bool m_bToggleBits;  // if true pressing a Bit button toggles the value, otherwise it only sets it
-  byte m_iCycleDelayMilliseconds;      // delay each cpu "cycle"
+  bool m_bHistoricalSpeed;  // if true the CPU runs at the speed of a KENBAK-1, see CPU::Cycles()
+  word m_iCycleDelayMilliseconds;      // delay each cpu "cycle", see SetCPUSpeed()
   byte m_iEEPROMSlotMap;  // indicates halving of program slots in EEPROM, see Memory::BuildSlots()
   byte m_iAutoRunProgram;
   
 private:
+  byte ReadItem(byte Item, byte Value, CPU* pCPU);
   void UpdateFlags(byte Value);
   void CheckStartupConfig();
-  byte ReadFromEEPROM(bool Read, byte EEPROMPage);
+  byte ReadFromEEPROM(CPU* pCPU, bool Read, byte EEPROMPage);
   byte m_EEPROMOffset;
   byte m_RAMOffset;
   int m_EEPROMSize;
@@ -0,0 +1,314 @@
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include "Disasm.h"
+#include "CPU.h"
+
+#ifdef DISASM_ENABLED
+#define MAP_READ(_m, _a)  bitRead(_m[(_a) >> 3], (_a) & 0x07)
+#define MAP_SET(_m, _a)   bitSet(_m[(_a) >> 3], (_a) & 0x07)
+#define MAP_CLEAR(_m, _a) bitClear(_m[(_a) >> 3], (_a) & 0x07)
+
+void Disasm::Report(CPU* pCPU, byte Entry1, byte Entry2)
+{
+  // the code reachable from Entry1 & Entry2 (e.g. P and the Address register) a basic block at a time, the end of
+  // each block shows where it goes and its size & cycles, and the rest of memory as data
+  m_pCPU = pCPU;
+  memset(m_pCode, 0, sizeof(m_pCode));
+  memset(m_pCovered, 0, sizeof(m_pCovered));
+  memset(m_pLeaders, 0, sizeof(m_pLeaders));
+  memset(m_pMarks, 0, sizeof(m_pMarks));
+  memset(m_pPending, 0, sizeof(m_pPending));
+  m_bGuess = false;
+  Reach(Entry1);
+  Reach(Entry2);
+  Trace();
+  // then guess where the indirect jumps that aren't returns go
+  m_bGuess = true;
+  for (int PC = 0; PC < 256; PC++)
+  {
+    if (MAP_READ(m_pCode, PC) && IsControl(PC))
+    {
+      byte pSucc[2];
+      for (byte Succ = Successors(PC, pSucc); Succ; Succ--)
+        Reach(pSucc[Succ - 1]);
+    }
+  }
+  Trace();
+
+  Serial.print("[disasm ");
+  PrintOctal(Entry1);
+  Serial.print(' ');
+  PrintOctal(Entry2);
+  Serial.println();
+  int Addr = 0;
+  byte BlockBytes = 0;
+  word BlockCycles = 0;
+  word CodeBytes = 0;
+  while (Addr < 256)
+  {
+    if (MAP_READ(m_pCode, Addr))
+    {
+      if (MAP_READ(m_pLeaders, Addr))
+        Serial.println();
+      PrintInstruction(Addr);
+      byte Instruction = m_pCPU->Read(Addr);
+      byte Length = DECODE_LENGTH(CPU::Decode(Instruction));
+      byte Next = Addr + Length;
+      BlockBytes += Length;
+      BlockCycles += CPU::Cycles(Instruction);
+      CodeBytes += Length;
+      if (IsControl(Addr) || MAP_READ(m_pLeaders, Next) || !MAP_READ(m_pCode, Next))
+      {
+        PrintEdges(Addr);
+        Serial.print("  (");
+        Serial.print(BlockBytes);
+        Serial.print(" bytes ");
+        Serial.print(BlockCycles);
+        Serial.print(" cycles)");
+        BlockBytes = 0;
+        BlockCycles = 0;
+      }
+      Serial.println();
+      // an operand which is also jumped to is shown as an instruction too
+      Addr += (Length == 2 && !MAP_READ(m_pCode, (byte)(Addr + 1)))?2:1;
+    }
+    else if (MAP_READ(m_pCovered, Addr))
+    {
+      Addr++;
+    }
+    else
+    {
+      // up to 8 bytes of data a line
+      PrintOctal(Addr);
+      Serial.print(": data");
+      for (byte Count = 0; Count < 8 && Addr < 256 && !MAP_READ(m_pCovered, Addr); Count++, Addr++)
+      {
+        Serial.print(' ');
+        PrintOctal(m_pCPU->Read(Addr));
+      }
+      Serial.println();
+    }
+  }
+  Serial.print("code ");
+  Serial.print(CodeBytes);
+  Serial.println(" bytes]");
+}
+
+bool Disasm::IsControl(byte PC)
+{
+  // does the instruction at PC end a basic block
+  byte Class = DECODE_CLASS(CPU::Decode(m_pCPU->Read(PC)));
+  return Class == CPU::eOpHalt || Class == CPU::eOpSkip0 || Class == CPU::eOpSkip1 || Class == CPU::eOpJump || Class == CPU::eOpJumpMark;
+}
+
+byte Disasm::MarkOf(byte PC)
+{
+  // where the JMK at PC writes its return address, the subroutine starts after it
+  word Decoded = CPU::Decode(m_pCPU->Read(PC));
+  byte Operand = m_pCPU->Read(PC + 1);
+  return (DECODE_MODE(Decoded) == OP_MODE_CONST)?Operand:m_pCPU->Read(Operand);
+}
+
+byte Disasm::Successors(byte PC, byte* pSucc)
+{
+  // where control can go after the instruction at PC (at most 2).  Returns through a mark aren't included, see PrintEdges()
+  word Decoded = CPU::Decode(m_pCPU->Read(PC));
+  byte Class = DECODE_CLASS(Decoded);
+  byte Next = PC + DECODE_LENGTH(Decoded);
+  byte Operand = m_pCPU->Read(PC + 1);
+  byte Count = 0;
+  if (Class == CPU::eOpHalt)
+    return 0;
+  if (Class == CPU::eOpSkip0 || Class == CPU::eOpSkip1)
+  {
+    pSucc[Count++] = Next;
+    pSucc[Count++] = Next + 2;
+    return Count;
+  }
+  if (Class != CPU::eOpJump && Class != CPU::eOpJumpMark)
+  {
+    pSucc[Count++] = Next;
+    return Count;
+  }
+  if (DECODE_FIELD(Decoded) || Class == CPU::eOpJumpMark)
+    pSucc[Count++] = Next;  // not taken, or the subroutine returns
+  if (DECODE_MODE(Decoded) != OP_MODE_CONST)
+  {
+    if ((Class == CPU::eOpJump && MAP_READ(m_pMarks, Operand)) || !m_bGuess)
+      return Count;
+    Operand = m_pCPU->Read(Operand);
+  }
+  pSucc[Count++] = (Class == CPU::eOpJumpMark)?Operand + 1:Operand;
+  return Count;
+}
+
+void Disasm::Reach(byte Addr)
+{
+  // a basic block starts at Addr, trace it if it hasn't been
+  MAP_SET(m_pLeaders, Addr);
+  if (!MAP_READ(m_pCode, Addr))
+    MAP_SET(m_pPending, Addr);
+}
+
+void Disasm::Trace()
+{
+  // follow the pending blocks' straight-line code, and the blocks they lead to
+  bool bMore = true;
+  while (bMore)
+  {
+    bMore = false;
+    for (int Addr = 0; Addr < 256; Addr++)
+    {
+      if (!MAP_READ(m_pPending, Addr))
+        continue;
+      MAP_CLEAR(m_pPending, Addr);
+      bMore = true;
+      byte PC = Addr;
+      while (!MAP_READ(m_pCode, PC))
+      {
+        word Decoded = CPU::Decode(m_pCPU->Read(PC));
+        MAP_SET(m_pCode, PC);
+        MAP_SET(m_pCovered, PC);
+        if (DECODE_LENGTH(Decoded) == 2)
+          MAP_SET(m_pCovered, (byte)(PC + 1));
+        if (DECODE_CLASS(Decoded) == CPU::eOpJumpMark && (DECODE_MODE(Decoded) == OP_MODE_CONST || m_bGuess))
+          MAP_SET(m_pMarks, MarkOf(PC));
+        byte pSucc[2];
+        byte Count = Successors(PC, pSucc);
+        if (IsControl(PC))
+        {
+          while (Count--)
+            Reach(pSucc[Count]);
+          break;
+        }
+        PC = pSucc[0];
+      }
+    }
+  }
+}
+
+void Disasm::PrintOctal(byte Value)
+{
+  // 3 digits
+  Serial.print((char)('0' + (Value >> 6)));
+  Serial.print((char)('0' + ((Value >> 3) & 0x07)));
+  Serial.print((char)('0' + (Value & 0x07)));
+}
+
+void Disasm::PrintOperand(byte Mode, byte Operand)
+{
+  // #const, mem, (ind), mem,X or (ind),X
+  if (Mode == OP_MODE_CONST)
+    Serial.print('#');
+  if (Mode == OP_MODE_INDIRECT || Mode == OP_MODE_INDIND)
+    Serial.print('(');
+  PrintOctal(Operand);
+  if (Mode == OP_MODE_INDIRECT || Mode == OP_MODE_INDIND)
+    Serial.print(')');
+  if (Mode == OP_MODE_INDEXED || Mode == OP_MODE_INDIND)
+    Serial.print(",X");
+}
+
+void Disasm::PrintInstruction(byte PC)
+{
+  // address, bytes & mnemonic, e.g. "004: 103 001  ADD  B #001"
+  byte Instruction = m_pCPU->Read(PC);
+  byte Operand = m_pCPU->Read(PC + 1);
+  word Decoded = CPU::Decode(Instruction);
+  byte Class = DECODE_CLASS(Decoded);
+  char Reg = "ABXP"[DECODE_REG(Decoded)];
+  PrintOctal(PC);
+  Serial.print(": ");
+  PrintOctal(Instruction);
+  Serial.print(' ');
+  if (DECODE_LENGTH(Decoded) == 2)
+    PrintOctal(Operand);
+  else
+    Serial.print("   ");
+  Serial.print("  ");
+  for (byte Char = 0; Char < 4; Char++)
+    Serial.print((char)pgm_read_byte(CPU::s_ClassNames + Class * 4 + Char));
+  Serial.print(' ');
+  switch (Class)
+  {
+    case CPU::eOpShiftRight:
+    case CPU::eOpRotateRight:
+    case CPU::eOpShiftLeft:
+    case CPU::eOpRotateLeft:
+      Serial.print(Reg);
+      Serial.print(',');
+      Serial.print(DECODE_FIELD(Decoded));
+      break;
+    case CPU::eOpSet0:
+    case CPU::eOpSet1:
+    case CPU::eOpSkip0:
+    case CPU::eOpSkip1:
+      Serial.print(DECODE_FIELD(Decoded));
+      Serial.print(',');
+      PrintOctal(Operand);
+      break;
+    case CPU::eOpJump:
+    case CPU::eOpJumpMark:
+    {
+      byte Test = DECODE_FIELD(Decoded);
+      if (Test)
+      {
+        Serial.print(Reg);
+        Serial.print((Test == OP_TEST_NE)?"!=0 ":(Test == OP_TEST_EQ)?"=0 ":(Test == OP_TEST_LT)?"<0 ":(Test == OP_TEST_GE)?">=0 ":">0 ");
+      }
+      PrintOperand(DECODE_MODE(Decoded) + 1, Operand);  // direct or indirect
+      break;
+    }
+    case CPU::eOpOr:
+    case CPU::eOpAnd:
+    case CPU::eOpLNeg:
+      PrintOperand(DECODE_MODE(Decoded), Operand);
+      break;
+    case CPU::eOpAdd:
+    case CPU::eOpSub:
+    case CPU::eOpLoad:
+    case CPU::eOpStore:
+      Serial.print(Reg);
+      Serial.print(' ');
+      PrintOperand(DECODE_MODE(Decoded), Operand);
+      break;
+  }
+}
+
+void Disasm::PrintEdges(byte PC)
+{
+  // the successors of the block ending at PC.  A return (an indirect jump through a mark) goes after each JMK
+  // which sets the mark, an indirect jump through anything else is guessed from the byte's value (?)
+  word Decoded = CPU::Decode(m_pCPU->Read(PC));
+  byte Class = DECODE_CLASS(Decoded);
+  byte Operand = m_pCPU->Read(PC + 1);
+  bool Indirect = (Class == CPU::eOpJump || Class == CPU::eOpJumpMark) && DECODE_MODE(Decoded) != OP_MODE_CONST;
+  bool Return = Indirect && Class == CPU::eOpJump && MAP_READ(m_pMarks, Operand);
+  byte pSucc[2];
+  byte Count = Successors(PC, pSucc);
+  Serial.print("  ->");
+  if (Class == CPU::eOpHalt)
+    Serial.print(" halt");
+  for (byte Succ = 0; Succ < Count; Succ++)
+  {
+    Serial.print(' ');
+    PrintOctal(pSucc[Succ]);
+    if (Indirect && !Return && Succ == Count - 1)
+      Serial.print('?');
+  }
+  if (Return)
+  {
+    Serial.print(" return");
+    for (int Call = 0; Call < 256; Call++)
+    {
+      if (MAP_READ(m_pCode, Call) && DECODE_CLASS(CPU::Decode(m_pCPU->Read(Call))) == CPU::eOpJumpMark && MarkOf(Call) == Operand)
+      {
+        Serial.print(' ');
+        PrintOctal(Call + 2);
+      }
+    }
+  }
+}
+
+Disasm disasm = Disasm();
+#endif
@@ -0,0 +1,40 @@
+#ifndef disasm_h
+#define disasm_h
+
+// define to disassemble memory to Serial as basic blocks with their successors (a control-flow graph), see disasm.txt
+// (costs ~165 bytes of RAM)
+//#define DISASM_ENABLED
+
+#ifdef DISASM_ENABLED
+class CPU;
+
+// follows the code reachable from the entry points, what isn't reached is data
+class Disasm
+{
+public:
+  void Report(CPU* pCPU, byte Entry1, byte Entry2);
+
+private:
+  void Reach(byte Addr);
+  void Trace();
+  byte Successors(byte PC, byte* pSucc);
+  byte MarkOf(byte PC);
+  bool IsControl(byte PC);
+  void PrintOctal(byte Value);
+  void PrintOperand(byte Mode, byte Operand);
+  void PrintInstruction(byte PC);
+  void PrintEdges(byte PC);
+
+  CPU* m_pCPU;
+  byte m_pCode[256/8];      // an instruction starts here
+  byte m_pCovered[256/8];   // an instruction (or its operand) is here, the rest is data
+  byte m_pLeaders[256/8];   // a basic block starts here
+  byte m_pMarks[256/8];     // a JMK's mark, which an indirect jump through returns
+  byte m_pPending[256/8];   // leaders still to trace
+  bool m_bGuess;            // follow indirect jumps through bytes which aren't marks, to the byte's value
+};
+
+extern Disasm disasm;
+#endif
+
+#endif
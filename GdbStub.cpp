@@ -0,0 +1,400 @@
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include "GdbStub.h"
+#include "CPU.h"
+#include "Buttons.h"
+#include "LEDS.h"
+
+#ifdef GDBSTUB_ENABLED
+#define GDB_SIGINT  2
+#define GDB_SIGTRAP 5
+
+// the registers, in 'g' packet order, see RegAddr()
+const char s_TargetXML[] PROGMEM =
+  "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target><feature name=\"org.kenbak.cpu\">"
+  "<reg name=\"a\" bitsize=\"8\" regnum=\"0\"/>"
+  "<reg name=\"b\" bitsize=\"8\"/>"
+  "<reg name=\"x\" bitsize=\"8\"/>"
+  "<reg name=\"p\" bitsize=\"8\" type=\"code_ptr\"/>"
+  "<reg name=\"fa\" bitsize=\"8\"/>"
+  "<reg name=\"fb\" bitsize=\"8\"/>"
+  "<reg name=\"fx\" bitsize=\"8\"/>"
+  "</feature></target>";
+
+void GdbStub::Serve(CPU* pCPU)
+{
+  // answer GDB until it detaches or kills the program, or STOP is pressed while the CPU isn't running
+  char Packet[GDBSTUB_PACKET_SIZE + 1];
+  m_pCPU = pCPU;
+  m_Signal = GDB_SIGTRAP;
+  m_Reason = CPU::eStopBudget;
+  m_bReplied = false;
+  leds.Display(m_pCPU->Read(REG_OUTPUT_IDX), 0x00);
+  while (ReadPacket(Packet) && Command(Packet))
+  {
+    m_bReplied = true;
+    leds.Display(m_pCPU->Read(REG_OUTPUT_IDX), 0x00);
+  }
+}
+
+bool GdbStub::Stopped()
+{
+  word State, Pressed;
+  return buttons.GetButtons(State, Pressed, false) && buttons.IsPressed(Pressed, Buttons::eRunStop);
+}
+
+bool GdbStub::ReadPacket(char* pPacket)
+{
+  // wait for $packet#checksum and acknowledge it, false if STOP is pressed first
+  // a '-' outside a packet (GDB didn't get the last reply) resends the reply still in pPacket,
+  // anything else outside a packet (e.g. GDB's '+') is ignored
+  byte Length = 0;
+  byte Sum = 0;
+  byte Check = 0;
+  byte State = 0;   // 0 waiting for '$', 1 in the packet, 2 & 3 the checksum's digits
+  for (;;)
+  {
+    if (Stopped())
+      return false;
+    int ch = Serial.read();
+    if (ch < 0)
+      continue;
+    if (ch == '$')
+    {
+      Length = Sum = Check = 0;
+      State = 1;
+      m_bReplied = false;   // about to be over-written
+    }
+    else if (State == 0)
+    {
+      if (ch == '-' && m_bReplied)
+        SendPacket(pPacket);
+    }
+    else if (State == 1)
+    {
+      if (ch == '#')
+        State = 2;
+      else
+      {
+        if (Length < GDBSTUB_PACKET_SIZE)
+          pPacket[Length++] = ch;
+        Sum += ch;
+      }
+    }
+    else if (State >= 2)
+    {
+      const char Digit[2] = {(char)ch, 0};
+      const char* pDigit = Digit;
+      Check = (Check << 4) | ParseHex(pDigit);
+      if (State++ == 3)
+      {
+        pPacket[Length] = 0;
+        Serial.write((Check == Sum)?'+':'-');
+        if (Check == Sum)
+          return true;
+        State = 0;
+      }
+    }
+  }
+}
+
+void GdbStub::SendPacket(const char* pPacket)
+{
+  // $packet#checksum, ReadPacket resends it if GDB asks
+  byte Sum = 0;
+  Serial.write('$');
+  for (; *pPacket; pPacket++)
+  {
+    Serial.write(*pPacket);
+    Sum += *pPacket;
+  }
+  char Check[3];
+  *PutHex(Check, Sum) = 0;
+  Serial.write('#');
+  Serial.print(Check);
+}
+
+word GdbStub::ParseHex(const char*& pHex)
+{
+  // hex digits at pHex, which is left at the first non-digit
+  word Value = 0;
+  for (;; pHex++)
+  {
+    char ch = *pHex;
+    if (ch >= '0' && ch <= '9')
+      Value = (Value << 4) | (ch - '0');
+    else if (ch >= 'a' && ch <= 'f')
+      Value = (Value << 4) | (ch - 'a' + 10);
+    else if (ch >= 'A' && ch <= 'F')
+      Value = (Value << 4) | (ch - 'A' + 10);
+    else
+      return Value;
+  }
+}
+
+char* GdbStub::PutHex(char* pOut, byte Value)
+{
+  // 2 hex digits, returns where the next goes
+  static const char Digits[] = "0123456789abcdef";
+  *pOut++ = Digits[Value >> 4];
+  *pOut++ = Digits[Value & 0x0F];
+  return pOut;
+}
+
+byte GdbStub::RegAddr(word Reg)
+{
+  // GDB's register number to its address: A, B, X, P then A's, B's & X's flags.  0377 (Input) if there's no such register
+  if (Reg <= REG_P_IDX)
+    return Reg;
+  if (Reg <= 6)
+    return REG_FLAGS_A_IDX + Reg - 4;
+  return REG_INPUT_IDX;
+}
+
+void GdbStub::StopReply(char* pPacket, byte Signal)
+{
+  // S<signal>, or T05<kind>:<address>; for a watchpoint
+  char* pOut = pPacket;
+  *pOut++ = 'S';
+  pOut = PutHex(pOut, Signal);
+#ifdef CPU_BREAKPOINTS
+  byte Addr;
+  byte Kind = m_pCPU->BreakHit(Addr);
+  if (m_Reason == CPU::eStopBreakpoint && Kind != CPU::eBreakExecute)
+  {
+    pPacket[0] = 'T';
+    strcpy_P(pOut, (Kind == CPU::eBreakChange)?PSTR("watch:"):(Kind == CPU::eBreakRead)?PSTR("rwatch:"):PSTR("awatch:"));
+    pOut = PutHex(pOut + strlen(pOut), Addr);
+    *pOut++ = ';';
+  }
+#endif
+  *pOut = 0;
+}
+
+byte GdbStub::Continue()
+{
+  // run in batches until the CPU stops, GDB interrupts (^C) or STOP is pressed, returns the signal for GDB.
+  // HALT stops with SIGTRAP, P after the HALT
+  for (;;)
+  {
+    word Executed;
+    byte Reason = m_pCPU->Run(GDBSTUB_RUN_BATCH, Executed);
+    leds.Display(m_pCPU->Read(REG_OUTPUT_IDX), 0x00);
+    if (Reason != CPU::eStopBudget && Reason != CPU::eStopIdle)
+    {
+      m_Reason = Reason;
+      return GDB_SIGTRAP;
+    }
+    if (Serial.read() == 0x03 || Stopped())
+    {
+      m_Reason = CPU::eStopBudget;
+      return GDB_SIGINT;
+    }
+  }
+}
+
+bool GdbStub::SetBreakpoints(bool Set, byte Type, word Addr, word Length)
+{
+  // Z/z packets: 0 & 1 breakpoints, 2 write (i.e. change), 3 read & 4 access watchpoints of Length bytes.
+  // false if there's no room for another.  Points of different types share the CPU's kinds (e.g. Z3 & Z4 both
+  // watch reads) so removing one only clears the kinds no other point covering the byte still needs
+#ifdef CPU_BREAKPOINTS
+  static const byte Kinds[] = {CPU::eBreakExecute, CPU::eBreakExecute, CPU::eBreakChange, CPU::eBreakRead, CPU::eBreakRead | CPU::eBreakWrite};
+  if (Addr >= 256)
+    return true;
+  if (Type <= 1 || !Length)
+    Length = 1;
+  byte First = Addr;
+  byte Last = (Addr + Length > 256)?255:Addr + Length - 1;
+  tPoint* pPoint = NULL;
+  for (byte Point = 0; Point < GDBSTUB_POINTS && !pPoint; Point++)
+  {
+    tPoint& Entry = m_pPoints[Point];
+    if (Set?!Entry.m_Type:(Entry.m_Type == Type + 1 && Entry.m_First == First && Entry.m_Last == Last))
+      pPoint = &Entry;
+  }
+  if (!pPoint)
+    return !Set;  // full, or removing one that isn't set
+  pPoint->m_Type = Set?Type + 1:0;
+  pPoint->m_First = First;
+  pPoint->m_Last = Last;
+
+  for (word Byte = First; Byte <= Last; Byte++)
+  {
+    byte Kind = m_pCPU->GetBreakpoint(Byte) & ~Kinds[Type];
+    for (byte Point = 0; Point < GDBSTUB_POINTS; Point++)
+    {
+      tPoint& Entry = m_pPoints[Point];
+      if (Entry.m_Type && Entry.m_First <= Byte && Byte <= Entry.m_Last)
+        Kind |= Kinds[Entry.m_Type - 1];
+    }
+    m_pCPU->SetBreakpoint(Byte, Kind);
+  }
+  return true;
+#else
+  (void)Set; (void)Type; (void)Addr; (void)Length;
+  return true;
+#endif
+}
+
+void GdbStub::ReadFeatures(char* pPacket, word Offset, word Length)
+{
+  // qXfer:features:read:target.xml, the register descriptions: m<more> or l<the last>
+  word Size = strlen_P(s_TargetXML);
+  if (Offset > Size)
+    Offset = Size;
+  if (Length > GDBSTUB_PACKET_SIZE - 1)
+    Length = GDBSTUB_PACKET_SIZE - 1;
+  if (Length > Size - Offset)
+    Length = Size - Offset;
+  pPacket[0] = (Offset + Length < Size)?'m':'l';
+  memcpy_P(pPacket + 1, s_TargetXML + Offset, Length);
+  pPacket[Length + 1] = 0;
+}
+
+bool GdbStub::Command(char* pPacket)
+{
+  // do the packet, replacing it with the reply.  false ends the session
+  const char* pArgs = pPacket + 1;
+  char* pOut = pPacket;
+  switch (pPacket[0])
+  {
+    case '?':
+      StopReply(pPacket, m_Signal);
+      SendPacket(pPacket);
+      return true;
+    case 'g':
+      for (byte Reg = 0; Reg < 7; Reg++)
+        pOut = PutHex(pOut, m_pCPU->Read(RegAddr(Reg)));
+      break;
+    case 'G':
+      for (byte Reg = 0; Reg < 7 && pArgs[0] && pArgs[1]; Reg++, pArgs += 2)
+      {
+        const char Digits[3] = {pArgs[0], pArgs[1], 0};
+        const char* pDigits = Digits;
+        m_pCPU->Write(RegAddr(Reg), ParseHex(pDigits));
+      }
+      strcpy_P(pOut, PSTR("OK"));
+      pOut += 2;
+      break;
+    case 'p':
+    {
+      word Reg = ParseHex(pArgs);
+      if (Reg < 7)
+        pOut = PutHex(pOut, m_pCPU->Read(RegAddr(Reg)));
+      break;
+    }
+    case 'P':
+    {
+      word Reg = ParseHex(pArgs);
+      if (Reg < 7 && *pArgs++ == '=')
+        m_pCPU->Write(RegAddr(Reg), ParseHex(pArgs));
+      strcpy_P(pOut, PSTR("OK"));
+      pOut += 2;
+      break;
+    }
+    case 'm':
+    {
+      word Addr = ParseHex(pArgs);
+      pArgs++;  // ','
+      word Length = ParseHex(pArgs);
+      if (Length > GDBSTUB_PACKET_SIZE / 2)
+        Length = GDBSTUB_PACKET_SIZE / 2;
+      if (Addr >= 256)
+      {
+        strcpy_P(pOut, PSTR("E01"));
+        pOut += 3;
+      }
+      for (; Length && Addr < 256; Length--, Addr++)
+        pOut = PutHex(pOut, m_pCPU->Read(Addr));
+      break;
+    }
+    case 'M':
+    {
+      word Addr = ParseHex(pArgs);
+      pArgs++;  // ','
+      word Length = ParseHex(pArgs);
+      pArgs++;  // ':'
+      for (; Length && Addr < 256 && pArgs[0] && pArgs[1]; Length--, Addr++, pArgs += 2)
+      {
+        const char Digits[3] = {pArgs[0], pArgs[1], 0};
+        const char* pDigits = Digits;
+        m_pCPU->Write(Addr, ParseHex(pDigits));
+      }
+      strcpy_P(pOut, PSTR("OK"));
+      pOut += 2;
+      break;
+    }
+    case 'c':
+    case 's':
+      if (*pArgs)
+        m_pCPU->Write(REG_P_IDX, ParseHex(pArgs));
+      if (pPacket[0] == 'c')
+        m_Signal = Continue();
+      else
+      {
+        m_pCPU->Step();
+        m_Reason = CPU::eStopBudget;
+        m_Signal = GDB_SIGTRAP;
+      }
+      StopReply(pPacket, m_Signal);
+      SendPacket(pPacket);
+      return true;
+    case 'Z':
+    case 'z':
+    {
+#ifdef CPU_BREAKPOINTS
+      word Type = ParseHex(pArgs);
+      pArgs++;  // ','
+      word Addr = ParseHex(pArgs);
+      pArgs++;  // ','
+      word Length = ParseHex(pArgs);
+      if (Type <= 4)
+      {
+        if (SetBreakpoints(pPacket[0] == 'Z', Type, Addr, Length))
+          strcpy_P(pOut, PSTR("OK"));
+        else
+          strcpy_P(pOut, PSTR("E01"));
+        pOut += strlen(pOut);
+      }
+#endif
+      break;
+    }
+    case 'q':
+      if (!strncmp_P(pArgs, PSTR("Supported"), 9))
+      {
+        strcpy_P(pOut, PSTR("PacketSize="));
+        pOut = PutHex(pOut + strlen(pOut), GDBSTUB_PACKET_SIZE);
+        strcpy_P(pOut, PSTR(";qXfer:features:read+"));
+        pOut += strlen(pOut);
+      }
+      else if (!strncmp_P(pArgs, PSTR("Xfer:features:read:target.xml:"), 30))
+      {
+        pArgs += 30;
+        word Offset = ParseHex(pArgs);
+        pArgs++;  // ','
+        ReadFeatures(pPacket, Offset, ParseHex(pArgs));
+        SendPacket(pPacket);
+        return true;
+      }
+      else if (!strcmp_P(pArgs, PSTR("Attached")))
+        *pOut++ = '1';
+      break;
+    case 'H':
+      strcpy_P(pOut, PSTR("OK"));
+      pOut += 2;
+      break;
+    case 'D':
+      SendPacket("OK");
+      return false;
+    case 'k':
+      return false;
+  }
+  *pOut = 0;  // anything not understood gets an empty reply
+  SendPacket(pPacket);
+  return true;
+}
+
+GdbStub gdbstub = GdbStub();
+#endif
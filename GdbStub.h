@@ -0,0 +1,52 @@
+#ifndef gdbstub_h
+#define gdbstub_h
+
+// define to debug programs with GDB's remote serial protocol over Serial, see gdb.txt
+// (breakpoints and watchpoints need CPU_BREAKPOINTS)
+//#define GDBSTUB_ENABLED
+#define GDBSTUB_PACKET_SIZE 64      // largest packet, on the stack while debugging
+#define GDBSTUB_RUN_BATCH   200     // instructions per CPU::Run between checks for an interrupt
+#define GDBSTUB_POINTS      8       // breakpoints & watchpoints GDB can set at once (costs 3 bytes of RAM each)
+
+#ifdef GDBSTUB_ENABLED
+class CPU;
+
+// answers GDB's packets: registers, memory, continue, step & breakpoints
+class GdbStub
+{
+public:
+  void Serve(CPU* pCPU);
+
+private:
+  bool ReadPacket(char* pPacket);
+  void SendPacket(const char* pPacket);
+  bool Command(char* pPacket);
+  void StopReply(char* pPacket, byte Signal);
+  byte Continue();
+  bool SetBreakpoints(bool Set, byte Type, word Addr, word Length);
+  void ReadFeatures(char* pPacket, word Offset, word Length);
+  bool Stopped();
+  byte RegAddr(word Reg);
+  static word ParseHex(const char*& pHex);
+  static char* PutHex(char* pOut, byte Value);
+
+  CPU* m_pCPU;
+  byte m_Signal;    // why the CPU last stopped, for GDB
+  byte m_Reason;    // and the CPU::tStopReason
+  bool m_bReplied;  // the packet buffer holds the last reply, resent if GDB asks ('-')
+
+  // what GDB has set with Z (kept between sessions, as the CPU's breakpoints are), so z only clears the kinds no
+  // other point needs
+  struct tPoint
+  {
+    byte m_Type;    // Z0-4 + 1, 0 if unused
+    byte m_First;   // the addresses covered
+    byte m_Last;
+  };
+  tPoint m_pPoints[GDBSTUB_POINTS];
+};
+
+extern GdbStub gdbstub;
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+#include <Arduino.h>
+#include "Heatmap.h"
+#include "CPU.h"
+
+#ifdef HEATMAP_ENABLED
+void Heatmap::Start()
+{
+  // a new run, start counting from 0
+  memset(this, 0, sizeof(Heatmap));
+  m_Random = 1;
+}
+
+void Heatmap::Count(byte Kind, byte Addr)
+{
+  // one more access, and it's in the working set
+  // the count is logarithmic, N is incremented with a probability of 1/2^N, so it's about log2(accesses)
+  // (pseudo-random, to leave the program's random() alone)
+  m_Random ^= m_Random << 7;
+  m_Random ^= m_Random >> 9;
+  m_Random ^= m_Random << 8;
+  byte* pCounts = m_pCounts[Kind] + (Addr >> 1);
+  byte Shift = (Addr & 0x01) << 2;
+  byte Count = (*pCounts >> Shift) & 0x0F;
+  if (Count < 0x0F && !(m_Random & ((1 << Count) - 1)))
+    *pCounts += 1 << Shift;
+  bitSet(m_pWindow[Addr >> 3], Addr & 0x07);
+}
+
+byte Heatmap::Level(byte Kind, byte Addr)
+{
+  return (m_pCounts[Kind][Addr >> 1] >> ((Addr & 0x01) << 2)) & 0x0F;
+}
+
+void Heatmap::Before(CPU* pCPU)
+{
+  // the CPU is about to execute an instruction, count what it will access
+  byte PC = pCPU->Read(REG_P_IDX);
+  word Decoded = CPU::Decode(pCPU->Read(PC));
+  byte Class = DECODE_CLASS(Decoded);
+  byte Mode = DECODE_MODE(Decoded);
+  byte Reg = DECODE_REG(Decoded);
+  byte Addr = pCPU->OperandAddr(PC);
+  Count(eExecute, PC);
+  if (DECODE_LENGTH(Decoded) == 1)
+  {
+    if (Class == CPU::eOpNOOPExtension)
+    {
+      Count(eRead, REG_A_IDX);
+      Count(eRead, REG_B_IDX);
+      Count(eWrite, REG_A_IDX);
+      Count(eWrite, REG_B_IDX);
+    }
+    else if (Class >= CPU::eOpShiftRight)
+    {
+      Count(eRead, Reg);
+      Count(eWrite, Reg);
+    }
+    return;
+  }
+  Count(eExecute, PC + 1);
+  if (Mode == OP_MODE_INDIRECT || Mode == OP_MODE_INDIND)
+    Count(eRead, pCPU->Read(PC + 1));  // the pointer
+  if (Mode == OP_MODE_INDEXED || Mode == OP_MODE_INDIND)
+    Count(eRead, REG_X_IDX);
+  switch (Class)
+  {
+    case CPU::eOpNOOPExtension:
+      break;
+    case CPU::eOpSet0:
+    case CPU::eOpSet1:
+      Count(eRead, Addr);
+      Count(eWrite, Addr);
+      break;
+    case CPU::eOpJump:
+    case CPU::eOpJumpMark:
+      if (DECODE_FIELD(Decoded))
+        Count(eRead, Reg);  // the test
+      if (Mode != OP_MODE_CONST)
+        Count(eRead, Addr);  // the target
+      if (Class == CPU::eOpJumpMark && CPU::JumpTaken(Decoded, pCPU->Read(Reg)))
+        Count(eWrite, pCPU->Read(Addr));  // the mark, only if it jumps
+      break;
+    case CPU::eOpOr:
+    case CPU::eOpAnd:
+    case CPU::eOpAdd:
+    case CPU::eOpSub:
+      Count(eRead, Reg);
+      // fall through
+    case CPU::eOpLNeg:
+    case CPU::eOpLoad:
+      if (Mode != OP_MODE_CONST)
+        Count(eRead, Addr);
+      Count(eWrite, Reg);
+      if (Class == CPU::eOpAdd || Class == CPU::eOpSub)
+        Count(eWrite, REG_FLAGS_A_IDX + Reg);
+      break;
+    case CPU::eOpStore:
+      Count(eRead, Reg);
+      Count(eWrite, Addr);
+      break;
+    default:  // skips
+      Count(eRead, Addr);
+      break;
+  }
+}
+
+void Heatmap::After(CPU* pCPU)
+{
+  // the instruction has executed
+  if (++m_WindowInstructions == HEATMAP_WINDOW)
+  {
+    m_WorkingSet = 0;
+    for (byte Byte = 0; Byte < sizeof(m_pWindow); Byte++)
+    {
+      for (byte Bits = m_pWindow[Byte]; Bits; Bits &= Bits - 1)
+        m_WorkingSet++;
+    }
+    if (m_WorkingSet > m_MaxWorkingSet)
+      m_MaxWorkingSet = m_WorkingSet;
+    memset(m_pWindow, 0, sizeof(m_pWindow));
+    m_WindowInstructions = 0;
+  }
+}
+
+void Heatmap::Report()
+{
+  // for reads, writes & executes: 16 lines of 16 hex digits, N means about 2^N accesses of each address
+  // (0 none).  Then the working set
+  Serial.println("[heatmap");
+  for (byte Kind = eRead; Kind < eKinds; Kind++)
+  {
+    Serial.println((Kind == eRead)?"read":(Kind == eWrite)?"write":"execute");
+    for (int Addr = 0; Addr < 256; Addr++)
+    {
+      Serial.print(Level(Kind, Addr), HEX);
+      if (Addr % 16 == 15)
+        Serial.println();
+    }
+  }
+  Serial.print("working set ");
+  Serial.print(m_WorkingSet);
+  Serial.print(" max ");
+  Serial.print(m_MaxWorkingSet);
+  Serial.print(" bytes per ");
+  Serial.print(HEATMAP_WINDOW);
+  Serial.println(" instructions");
+  Serial.println("]");
+}
+
+Heatmap heatmap = Heatmap();
+#endif
@@ -0,0 +1,45 @@
+#ifndef heatmap_h
+#define heatmap_h
+
+// define to count each run's reads, writes and executes of each address, and its working set, see Heatmap::Report()
+// (costs ~420 bytes of RAM)
+//#define HEATMAP_ENABLED
+#define HEATMAP_WINDOW 256   // instructions in each working set window
+
+#ifdef HEATMAP_ENABLED
+class CPU;
+
+// which bytes a program really touches
+class Heatmap
+{
+public:
+  enum tKind
+  {
+    eRead,
+    eWrite,
+    eExecute,
+
+    eKinds
+  };
+
+  void Start();
+  void Before(CPU* pCPU);
+  void After(CPU* pCPU);
+  void Report();
+
+private:
+  void Count(byte Kind, byte Addr);
+  byte Level(byte Kind, byte Addr);
+
+  byte m_pCounts[eKinds][128];    // 4 bits per address, log2 of the accesses
+  word m_Random;                  // see Count()
+  byte m_pWindow[256/8];          // addresses touched in the current window
+  word m_WindowInstructions;
+  word m_WorkingSet;              // addresses touched in the last complete window
+  word m_MaxWorkingSet;
+};
+
+extern Heatmap heatmap;
+#endif
+
+#endif
@@ -45,7 +45,7 @@ void setup()
   leds.Init();
   cpu.Init();
   memory.Init();
-  mcp.Init();
+  mcp.Init(&cpu);
 }
 
 void loop() 
@@ -5,11 +5,26 @@
 #include "Buttons.h"
 #include "CPU.h"
 #include "Memory.h"
+#include "Pacer.h"
+#include "Recorder.h"
+#include "Tracer.h"
+#include "Profiler.h"
+#include "Heatmap.h"
+#include "GdbStub.h"
+#include "Disasm.h"
+#include "Analyser.h"
 #include "MCP.h"
+#ifdef __AVR__
+#include <avr/sleep.h>
+#endif
 
 // define to revert to RUN LED not turned off when HALT encountered or STOP pressed
 //#define MCP_LEGACY_RUN_LED 
 
+// instructions run between checking the buttons, when running at full speed
+#define MCP_RUN_BATCH 32
+
+
 void ExtendedCPU::Init()
 {
   CPU::Init();
@@ -22,13 +37,19 @@ bool ExtendedCPU::OnNOOPExtension(byte Op)
   // implement extension op-code 
   if (Op == 0360)
   {
+    // instructions are run in batches, show the output before any delay
+    mcp.m_Data = Read(REG_OUTPUT_IDX);
+    leds.Display(mcp.m_Data, mcp.m_Control);
     // operation+index in A, arg in B
     byte A = Read(REG_A_IDX);
     byte B = Read(REG_B_IDX);
-    if (mcp.SystemCall(A, B))
+    if (A != (0x80 | Config::eControlDelayMilliSec) && A != (0x80 | Config::eControlLEDs))
+      OnExternalIO();  // reads the clock, serial etc, the program isn't idle
+    if (mcp.SystemCall(this, A, B))
     {
-      Write(REG_A_IDX, A);
-      Write(REG_B_IDX, B);
+      // registers, no need for Write()
+      m_Memory[REG_A_IDX] = A;
+      m_Memory[REG_B_IDX] = B;
       config.m_iCycleDelayMilliseconds = 0;
       return true;
     }
@@ -54,6 +75,16 @@ bool ExtendedCPU::OnNOOPExtension(byte Op)
 // Extension: BitN+Stop set CPU speed to N
 // Extension: BitN+Disp write memory out to Serial
 // Extension: BitN+Set set memory from Serial
+// Extension: Stop+Disp report CPU speed to Serial
+// Extension: Clear+Disp report the profile of the last run to Serial (if PROFILER_ENABLED)
+// Extension: Read+Disp report the memory accesses of the last run to Serial (if HEATMAP_ENABLED)
+// Extension: Disp+Start record the run to Serial, Set+Start replay it (if RECORDER_ENABLED)
+// Extension: Read+Start trace the run to Serial (if TRACER_ENABLED)
+// Extension: Clear+Start step back, Stor+Start step back to before the byte at Address changed (if CPU_UNDO)
+// Extension: Stop+Set set breakpoints at Address from Input (if CPU_BREAKPOINTS)
+// Extension: Stor+Disp debug with GDB over Serial (if GDBSTUB_ENABLED)
+// Extension: Set+Disp disassemble memory to Serial from P and Address (if DISASM_ENABLED)
+// Extension: Disp+Read analyse the program to Serial, Disp+Stor the built-in programs (if ANALYSER_ENABLED)
 //
 // Press at power on to configure program to auto-run
 // * Stop & BitN  = load built-in program N
@@ -65,9 +96,11 @@ bool ExtendedCPU::OnNOOPExtension(byte Op)
 
 
 
-void MCP::Init()
+void MCP::Init(CPU* pCPU)
 {
+  m_pCPU = pCPU;
   m_bRunning = false;
+  m_bIdle = false;
   Splash();
   m_Data = 0x00;
   m_Control = 0x00;
@@ -108,19 +141,22 @@ void MCP::Loop()
       HandleButtonRunning(State, Pressed);
     }
     
-    if (m_bRunning)
+    if (m_bIdle)
     {
-      m_bRunning = CPU::cpu->Step();
-      m_Data = CPU::cpu->Read(REG_OUTPUT_IDX);
+      // the program is waiting for a button (see CPU_IDLE_DETECT), doze until the next timer tick
+#ifdef __AVR__
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      sleep_mode();
+#endif
+    }
+    else if (m_bRunning)
+    {
+      RunPaced();
+      m_Data = m_pCPU->Read(REG_OUTPUT_IDX);
 #ifndef MCP_LEGACY_RUN_LED 
       if (!m_bRunning)
         SetMode(eNone); // Turn off Run when HALTed
 #endif        
-      // slow things down...
-      if (config.m_iCycleDelayMilliseconds)
-      {
-        delay(config.m_iCycleDelayMilliseconds);
-      }
     }
   }
   else
@@ -130,9 +166,149 @@ void MCP::Loop()
       HandleButtonHalted(State, Pressed);
     }
   }
+#ifdef TRACER_ENABLED
+  tracer.Drain(false);  // in the background, as Serial has room
+#endif
   leds.Display(m_Data, m_Control);
 }
 
+void MCP::RunPaced()
+{
+  // at full speed run a batch, otherwise run what is due (possibly nothing) against the pacer's deadline
+  // each instruction costs either its memory cycles (historical speed) or the CPU Speed delay
+  unsigned long Delay = config.m_iCycleDelayMilliseconds * 1000UL;
+  word Executed = 0;
+  byte Reason = CPU::eStopBudget;
+  if (!config.m_bHistoricalSpeed && !Delay)
+  {
+    Reason = RunCPU(MCP_RUN_BATCH, Executed);
+  }
+  else
+  {
+    // catch up in batches if the loop fell behind, but keep polling the buttons
+    while (Reason == CPU::eStopBudget && Executed < MCP_RUN_BATCH && pacer.Due())
+    {
+      word Stepped;
+      unsigned long Cycles = m_pCPU->TotalCycles();
+      Reason = RunCPU(1, Stepped);
+      Executed += Stepped;
+      pacer.Charge(config.m_bHistoricalSpeed?(m_pCPU->TotalCycles() - Cycles) * CPU_MEMORY_CYCLE_MICROSECONDS:Delay);
+    }
+  }
+  pacer.Count(Executed);
+  m_bIdle = (Reason == CPU::eStopIdle);
+  m_bRunning = (Reason == CPU::eStopBudget) || m_bIdle;
+#ifdef CPU_BREAKPOINTS
+  if (Reason == CPU::eStopBreakpoint)
+    m_pCPU->BreakHit(m_Address);  // so Read shows the byte (or instruction) that was hit
+#endif
+#ifdef RECORDER_ENABLED
+  if (!m_bRunning)
+    recorder.Stop();
+#endif
+#ifdef TRACER_ENABLED
+  if (!m_bRunning)
+    tracer.Stop();
+#endif
+}
+
+byte MCP::RunCPU(word Count, word& Executed)
+{
+  // run the CPU, one instruction at a time if something needs to see each one
+  if (!Stepwise())
+    return m_pCPU->Run(Count, Executed);
+  byte Reason = CPU::eStopBudget;
+  for (Executed = 0; Executed < Count && Reason == CPU::eStopBudget; )
+  {
+    word Stepped;
+    BeforeStep();
+    Reason = m_pCPU->Run(1, Stepped);
+    Reason = AfterStep(Reason, Stepped);
+    Executed += Stepped;
+  }
+  return Reason;
+}
+
+bool MCP::Stepwise()
+{
+  // recording or replaying (so every input's instruction count is exact), tracing or profiling
+  bool Stepwise = false;
+#ifdef RECORDER_ENABLED
+  Stepwise = Stepwise || recorder.Active();
+#endif
+#ifdef TRACER_ENABLED
+  Stepwise = Stepwise || tracer.Active();
+#endif
+#if defined(PROFILER_ENABLED) || defined(HEATMAP_ENABLED)
+  Stepwise = true;
+#endif
+  return Stepwise;
+}
+
+void MCP::BeforeStep()
+{
+  // see Stepwise()
+#ifdef RECORDER_ENABLED
+  byte Data;
+  while (recorder.Due(RECORDER_SOURCE_INPUT, Data))
+    m_pCPU->Write(REG_INPUT_IDX, Data);
+#endif
+#ifdef TRACER_ENABLED
+  if (tracer.Active())
+    tracer.Before(m_pCPU);
+#endif
+#ifdef PROFILER_ENABLED
+  profiler.Before(m_pCPU);
+#endif
+#ifdef HEATMAP_ENABLED
+  heatmap.Before(m_pCPU);
+#endif
+}
+
+byte MCP::AfterStep(byte Reason, word Stepped)
+{
+  // see Stepwise(), returns the (possibly changed) reason the CPU stopped
+#ifdef TRACER_ENABLED
+  if (tracer.Active())
+    tracer.After(m_pCPU);
+#endif
+#ifdef PROFILER_ENABLED
+  profiler.After(m_pCPU);
+#endif
+#ifdef HEATMAP_ENABLED
+  heatmap.After(m_pCPU);
+#endif
+#ifdef RECORDER_ENABLED
+  if (Reason == CPU::eStopIdle && recorder.Active())
+    Reason = CPU::eStopBudget;  // not while recording or replaying, every input is tagged with its instruction count
+  recorder.Count(Stepped);
+#else
+  (void)Stepped;
+#endif
+  return Reason;
+}
+
+void MCP::SetInput(byte Data)
+{
+  // the buttons have changed the Input register
+#ifdef RECORDER_ENABLED
+  if (m_bRunning && recorder.Replaying())
+    return;  // the recording provides the input
+  recorder.Input(RECORDER_SOURCE_INPUT, Data);
+#endif
+  m_pCPU->Write(REG_INPUT_IDX, Data);
+}
+
+void MCP::ReportSpeed()
+{
+  // achieved instructions/second and worst lateness against the pacing deadline, from the last run
+  Serial.print("ips=");
+  Serial.print(pacer.AchievedRate());
+  Serial.print(" jitter=");
+  Serial.print(pacer.Jitter());
+  Serial.println("us");
+}
+
 void MCP::SetControlLEDs(byte LEDs)
 {
   m_Control = LEDs;
@@ -217,6 +393,8 @@ void MCP::HandleButtonRunning(word , word Pressed)
   int Btn;
   if (buttons.GetButtonDown(Pressed, Btn))
   {
+    m_bIdle = false;  // something may have changed
+
     int Chord = Buttons::eUnused;  // no extensions while running
     switch (Btn)
     {
@@ -249,11 +427,11 @@ void MCP::HandleButtonRunning(word , word Pressed)
 void MCP::OnInputButton(int Btn, byte Chord)
 {
   // one of the input buttons has been hit
-  byte Data = CPU::cpu->Read(REG_INPUT_IDX);
+  byte Data = m_pCPU->Read(REG_INPUT_IDX);
   if (Chord == Buttons::eRunStop)
   {
     // Extension: Stop+BitN:load pre-defined program N
-    if (memory.LoadStandardProgram(Btn))
+    if (memory.LoadStandardProgram(m_pCPU, Btn))
     {
       Data = bit(Btn);
     }
@@ -274,12 +452,12 @@ void MCP::OnInputButton(int Btn, byte Chord)
     m_Data = Data;
     SetMode(eInput);
   }
-  CPU::cpu->Write(REG_INPUT_IDX, Data);
+  SetInput(Data);
 }
 
 void MCP::OnInputClear(byte Chord)
 {
-  CPU::cpu->Write(REG_INPUT_IDX, 0);
+  SetInput(0);
   if (!m_bRunning)
   {
     m_Data = 0;
@@ -299,6 +477,41 @@ void MCP::OnAddressDisplay(byte Chord)
     // Extension: BitN+Disp = write program memory to serial
     SerializeMemory(false, Chord);
   }
+  else if (Chord == Buttons::eRunStop)
+  {
+    // Extension: Stop+Disp = report the achieved CPU speed to serial
+    ReportSpeed();
+  }
+#ifdef PROFILER_ENABLED
+  else if (Chord == Buttons::eInputClear)
+  {
+    // Extension: Clear+Disp = report the last run's profile to serial
+    profiler.Report();
+  }
+#endif
+#ifdef HEATMAP_ENABLED
+  else if (Chord == Buttons::eMemoryRead)
+  {
+    // Extension: Read+Disp = report the last run's memory accesses to serial
+    heatmap.Report();
+  }
+#endif
+#ifdef DISASM_ENABLED
+  else if (Chord == Buttons::eAddressSet)
+  {
+    // Extension: Set+Disp = disassemble the code reachable from P and the Address register to serial
+    disasm.Report(m_pCPU, m_pCPU->Read(REG_P_IDX), m_Address);
+  }
+#endif
+#ifdef GDBSTUB_ENABLED
+  else if (Chord == Buttons::eMemoryStore)
+  {
+    // Extension: Stor+Disp = debug the program with GDB over serial, until STOP or GDB detaches
+    SetMode(eNone);
+    gdbstub.Serve(m_pCPU);
+    m_Data = m_pCPU->Read(REG_OUTPUT_IDX);
+  }
+#endif
   else
   {
     m_Data = m_Address;
@@ -313,9 +526,18 @@ void MCP::OnAddressSet(byte Chord)
     // Extension: BitN+Stor = store program memory from serial
     SerializeMemory(true, Chord);
   }
+#ifdef CPU_BREAKPOINTS
+  else if (Chord == Buttons::eRunStop)
+  {
+    // Extension: Stop+Set = set the breakpoints at Address to Input's low bits (CPU::tBreakKind), 0 clears them
+    m_pCPU->SetBreakpoint(m_Address, m_pCPU->Read(REG_INPUT_IDX) & 0x0F);
+    m_Data = m_pCPU->GetBreakpoint(m_Address);
+    Blink(eAddress);
+  }
+#endif
   else
   {
-    m_Address = CPU::cpu->Read(REG_INPUT_IDX);
+    m_Address = m_pCPU->Read(REG_INPUT_IDX);
     Blink(eAddress);
   }
 }
@@ -325,7 +547,7 @@ void MCP::OnMemoryRead(byte Chord)
   if (Chord <= Buttons::eBit7)
   {
     // Extension: BitN+Read read from EEPROM page N
-    m_Data = memory.ReadMemoryFromEEPROMSlot(Chord)?bit(Chord):0;
+    m_Data = memory.ReadMemoryFromEEPROMSlot(m_pCPU, Chord)?bit(Chord):0;
     SetMode(eNone);
   }
   else if (Chord == Buttons::eRunStop)
@@ -333,16 +555,23 @@ void MCP::OnMemoryRead(byte Chord)
     // Extension: Stop+Read sys read
     byte A = m_Address & 0x7F;
     byte B = 0;
-    if (SystemCall(A, B))
+    if (SystemCall(m_pCPU, A, B))
     {
-      CPU::cpu->Write(REG_OUTPUT_IDX, B);
+      m_pCPU->Write(REG_OUTPUT_IDX, B);
     }
     m_Data = B;
     SetMode(eNone);
   }
+#ifdef ANALYSER_ENABLED
+  else if (Chord == Buttons::eAddressDisplay)
+  {
+    // Extension: Disp+Read = analyse whether the program halts, cycles or reads input, to serial
+    analyser.Report(m_pCPU);
+  }
+#endif
   else
   {
-    m_Data = CPU::cpu->Read(m_Address++);
+    m_Data = m_pCPU->Read(m_Address++);
     SetMode(eMemory);
     Blink(eRun);
   }
@@ -353,17 +582,17 @@ void MCP::OnMemoryStore(byte Chord)
   if (Chord <= Buttons::eBit7)
   {
     // Extension: BitN+Store write to EEPROM page N
-    m_Data = memory.WriteMemoryToEEPROMSlot(Chord)?bit(Chord):0;
+    m_Data = memory.WriteMemoryToEEPROMSlot(m_pCPU, Chord)?bit(Chord):0;
     SetMode(eNone);
   }
   else if (Chord == Buttons::eRunStop)
   {
     // Extension: Stop+Store sys write
     byte A = m_Address | 0x80;
-    byte B = CPU::cpu->Read(REG_INPUT_IDX);
-    if (SystemCall(A, B))
+    byte B = m_pCPU->Read(REG_INPUT_IDX);
+    if (SystemCall(m_pCPU, A, B))
     {
-      CPU::cpu->Write(REG_OUTPUT_IDX, B);
+      m_pCPU->Write(REG_OUTPUT_IDX, B);
     }
     m_Data = B;
     SetMode(eNone);
@@ -371,16 +600,23 @@ void MCP::OnMemoryStore(byte Chord)
   else if (Chord == Buttons::eInputClear)
   {
     // Extension: Clear+Store clear memory
-    CPU::cpu->ClearAllMemory();
+    m_pCPU->ClearAllMemory();
     m_Address = REG_P_IDX + 1;
     config.m_iCycleDelayMilliseconds = 0;
-    CPU::cpu->Write(REG_P_IDX, m_Address);
+    m_pCPU->Write(REG_P_IDX, m_Address);
     SetMode(eNone);
   }
+#ifdef ANALYSER_ENABLED
+  else if (Chord == Buttons::eAddressDisplay)
+  {
+    // Extension: Disp+Stor = analyse each built-in program, to serial
+    analyser.ReportLibrary();
+  }
+#endif
   else
   {
-    byte Value = CPU::cpu->Read(REG_INPUT_IDX);
-    CPU::cpu->Write(m_Address++, Value);
+    byte Value = m_pCPU->Read(REG_INPUT_IDX);
+    m_pCPU->Write(m_Address++, Value);
     Blink(eRun);
   }
 }
@@ -390,14 +626,57 @@ void MCP::OnRunStart(byte Chord)
   SetMode(eRun);
   if (Chord == Buttons::eRunStop)  // single step
   {
-    CPU::cpu->Step();
-    m_Data = CPU::cpu->Read(REG_OUTPUT_IDX);
+    m_pCPU->Step();
+    m_Data = m_pCPU->Read(REG_OUTPUT_IDX);
+    Blink(eRun);
+  }
+#ifdef CPU_UNDO
+  else if (Chord == Buttons::eInputClear || Chord == Buttons::eMemoryStore)
+  {
+    // Extension: Clear+Start step back, Stor+Start step back to before the byte at Address last changed
+    if (Chord == Buttons::eInputClear)
+      m_pCPU->StepBack();
+    else
+      m_pCPU->RewindToChange(m_Address);
+    m_Data = m_pCPU->Read(REG_OUTPUT_IDX);
     Blink(eRun);
   }
+#endif
   else
   {
+#ifdef RECORDER_ENABLED
+    if (Chord == Buttons::eAddressDisplay)
+    {
+      // Extension: Disp+Start record the run to serial
+      recorder.Record(m_pCPU);
+    }
+    else if (Chord == Buttons::eAddressSet)
+    {
+      // Extension: Set+Start replay a recorded run from serial
+      if (!recorder.Replay(m_pCPU))
+      {
+        SetMode(eNone);
+        return;
+      }
+    }
+#endif
+#ifdef TRACER_ENABLED
+    if (Chord == Buttons::eMemoryRead)
+    {
+      // Extension: Read+Start trace the run to serial
+      tracer.Start();
+    }
+#endif
+#ifdef PROFILER_ENABLED
+    profiler.Start();
+#endif
+#ifdef HEATMAP_ENABLED
+    heatmap.Start();
+#endif
     // just go
     m_bRunning = true;
+    m_bIdle = false;
+    pacer.Start();
   }
 }
 
@@ -410,6 +689,12 @@ void MCP::OnRunStop(byte Chord)
     Blink(eRun);
   }
   m_bRunning = false;
+#ifdef RECORDER_ENABLED
+  recorder.Stop();
+#endif
+#ifdef TRACER_ENABLED
+  tracer.Stop();
+#endif
 #ifdef MCP_LEGACY_RUN_LED 
   SetMode(eRun);
 #else  
@@ -436,7 +721,7 @@ void MCP::Blink(byte LED)
   leds.Display(m_Data, m_Control);
 }
 
-bool MCP::SystemCall(byte& A, byte& B)
+bool MCP::SystemCall(CPU* pCPU, byte& A, byte& B)
 {
   byte Write = A & 0x80;
   byte Index = A & 0x7F;
@@ -448,12 +733,12 @@ bool MCP::SystemCall(byte& A, byte& B)
     }
     else
     {
-      return config.Write(Index, B);
+      return config.Write(Index, B, pCPU);
     }
   }
   else
   {
-    B = config.Read(Index, B);
+    B = config.Read(Index, B, pCPU);
   }
   return true;
 }
@@ -514,7 +799,7 @@ void MCP::SerializeMemory(bool Input, byte Chord)
           }
           else if (value != -1) // hit a non-digit and we've built up a value, save it
           {
-            CPU::cpu->Write(addr++, value);
+            m_pCPU->Write(addr++, value);
             sum += value;
             bitWrite(Control, eRun, !bitRead(Control, eRun)); // flash Run
             leds.Display(m_Data, Control);
@@ -528,7 +813,7 @@ void MCP::SerializeMemory(bool Input, byte Chord)
     
     if (value != -1 && addr < 256)  // ended on a number with no delimeter, save it
     {
-      CPU::cpu->Write(addr, value);
+      m_pCPU->Write(addr, value);
       sum += value;
     }
   
@@ -548,7 +833,7 @@ void MCP::SerializeMemory(bool Input, byte Chord)
         break;
       }
       
-      byte b = CPU::cpu->Read(addr);
+      byte b = m_pCPU->Read(addr);
       
       // don't flood the serial buffer
       int ctr = 0;
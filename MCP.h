@@ -4,7 +4,7 @@
 #include "CPU.h"
 
 // derived from the default KENBAK-1 cpu to over-ride NOOP
-class ExtendedCPU:public CPU
+class ExtendedCPU:public TCPU<ExtendedCPU>
 {
 public:
   virtual void Init();
@@ -26,7 +26,7 @@ public:
     eNone
   };
 
-  void Init();
+  void Init(CPU* pCPU);
   void Splash();
   void Loop();
   
@@ -35,6 +35,13 @@ public:
 
 private:
   void SetMode(byte Mode);
+  void RunPaced();
+  byte RunCPU(word Count, word& Executed);
+  bool Stepwise();
+  void BeforeStep();
+  byte AfterStep(byte Reason, word Stepped);
+  void SetInput(byte Data);
+  void ReportSpeed();
   void HandleButtonHalted(word State, word Pressed);
   void HandleButtonRunning(word State, word Pressed);
   void OnInputButton(int Btn, byte Chord);
@@ -46,12 +53,14 @@ private:
   void OnRunStart(byte Chord);
   void OnRunStop(byte Chord);
   void Blink(byte LED);
-  bool SystemCall(byte& A, byte& B);
+  bool SystemCall(CPU* pCPU, byte& A, byte& B);
   bool OnNOOPExtension(byte Op);
   void SerializeMemory(bool Input, byte Chord);
   void AutoRun(byte Auto);
   
+  CPU* m_pCPU;
   bool m_bRunning;
+  bool m_bIdle;  // running, but the CPU is looping until a button is pressed
   byte m_Data;
   byte m_Control;
   byte m_Mode;
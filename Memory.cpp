@@ -24,6 +24,7 @@
 // "assembled" on demand (see Programs.cpp).  The upside is they're easier to develop
 // the downside is they're a little slower to load, and they increase Arduino sketch size.
 // STOP PRESS: to free up some space, the Sieve program is now stored as PROGMEM, the source is #ifdef'd out
+// and now the rest of them are too, see PROGRAMS_PROGMEM in Programs.cpp
 prog_uchar programCounter[]  PROGMEM = {
     0000, 0000, 0000, 0004, 0103, 0001, 0134, 0200, 0344, 0004
 };
@@ -50,9 +51,9 @@ void Memory::Init()
   BuildSlots(config.m_iEEPROMSlotMap);
 }
 
-bool Memory::LoadStandardProgram(byte Index)
+bool Memory::LoadStandardProgram(CPU* pCPU, byte Index)
 {
-  byte* pMem = CPU::cpu->Memory();
+  byte* pMem = pCPU->Memory();
   if (Index == 0)
   {
     memcpy_P(pMem, programCounter, 10);
@@ -88,9 +89,9 @@ bool Memory::LoadStandardProgram(byte Index)
   return true;
 }
 
-bool Memory::ReadMemoryFromEEPROMSlot(byte Slot)
+bool Memory::ReadMemoryFromEEPROMSlot(CPU* pCPU, byte Slot)
 {
-  byte* pMem = CPU::cpu->Memory();
+  byte* pMem = pCPU->Memory();
   if (Slot <= 0x07 && m_pSlotSize[Slot])
   {
     int Base = m_pSlotStartAddr[Slot];
@@ -104,9 +105,9 @@ bool Memory::ReadMemoryFromEEPROMSlot(byte Slot)
   return false;
 }
 
-bool Memory::WriteMemoryToEEPROMSlot(byte Slot)
+bool Memory::WriteMemoryToEEPROMSlot(CPU* pCPU, byte Slot)
 {
-  byte* pMem = CPU::cpu->Memory();
+  byte* pMem = pCPU->Memory();
   if (Slot <= 0x07 && m_pSlotSize[Slot])
   {
     int Base = m_pSlotStartAddr[Slot];
@@ -1,15 +1,17 @@
 #ifndef memory_h
 #define memory_h
  
+class CPU;
+
 // handle EEPROM and PROGMEM
 class Memory
 {
 public:
   void Init();
   void BuildSlots(byte Map);
-  bool LoadStandardProgram(byte Index);
-  bool ReadMemoryFromEEPROMSlot(byte Slot);
-  bool WriteMemoryToEEPROMSlot(byte Slot);
+  bool LoadStandardProgram(CPU* pCPU, byte Index);
+  bool ReadMemoryFromEEPROMSlot(CPU* pCPU, byte Slot);
+  bool WriteMemoryToEEPROMSlot(CPU* pCPU, byte Slot);
   int GetEEPROMTopIdx();
   int SlotStartAddr(byte Slot);
   int SlotSize(byte Slot);
@@ -0,0 +1,72 @@
+#include <Arduino.h>
+#include "Pacer.h"
+
+Pacer::Pacer()
+{
+  m_AchievedRate = 0;
+  m_Jitter = 0;
+  Start();
+}
+
+void Pacer::Start()
+{
+  // (re)start from now, e.g. when RUN is pressed
+  m_DueMicros = micros();
+  m_WindowStartMicros = m_DueMicros;
+  m_WindowInstructions = 0;
+  m_WindowJitter = 0;
+}
+
+bool Pacer::Due()
+{
+  // has real time caught up with the CPU?
+  unsigned long Now = micros();
+  long Late = (long)(Now - m_DueMicros);
+  if (Late < 0)
+    return false;
+  if (Late > PACER_SLACK_MICROSECONDS)
+  {
+    // fallen too far behind (e.g. a SysInfo delay or an idle sleep), re-base rather than run flat out to catch up.
+    // That's not the pacer's jitter
+    m_DueMicros = Now;
+    return true;
+  }
+  if ((unsigned long)Late > m_WindowJitter)
+    m_WindowJitter = Late;
+  return true;
+}
+
+void Pacer::Charge(unsigned long Micros)
+{
+  // advance the deadline by the cost of what was run, not from when it finished, so errors don't accumulate
+  m_DueMicros += Micros;
+}
+
+void Pacer::Count(word Instructions)
+{
+  // accumulate the achieved rate, publish it once per window
+  m_WindowInstructions += Instructions;
+  unsigned long Elapsed = micros() - m_WindowStartMicros;
+  if (Elapsed >= PACER_WINDOW_MICROSECONDS)
+  {
+    m_AchievedRate = (m_WindowInstructions * 1000UL) / (Elapsed / 1000UL);
+    m_Jitter = m_WindowJitter;
+    m_WindowStartMicros += Elapsed;
+    m_WindowInstructions = 0;
+    m_WindowJitter = 0;
+  }
+}
+
+unsigned long Pacer::AchievedRate()
+{
+  // instructions per second, over the last complete window
+  return m_AchievedRate;
+}
+
+unsigned long Pacer::Jitter()
+{
+  // worst lateness in microseconds, over the last complete window
+  return m_Jitter;
+}
+
+Pacer pacer = Pacer();
@@ -0,0 +1,34 @@
+#ifndef pacer_h
+#define pacer_h
+
+// if the CPU falls this far behind (e.g. a SYSX delay) don't race to catch up
+#define PACER_SLACK_MICROSECONDS 50000L
+// how often the achieved rate and jitter are measured
+#define PACER_WINDOW_MICROSECONDS 1000000L
+
+// paces the CPU against micros(), drift-free
+// each instruction is charged a cost in microseconds, the next runs when real time catches up
+// it doesn't block, the MCP keeps polling the buttons & refreshing the LEDs while it waits
+class Pacer
+{
+public:
+  Pacer();
+  void Start();
+  bool Due();
+  void Charge(unsigned long Micros);
+  void Count(word Instructions);
+  unsigned long AchievedRate();
+  unsigned long Jitter();
+
+private:
+  unsigned long m_DueMicros;           // when the next instruction is due
+  unsigned long m_WindowStartMicros;   // start of the current measurement window
+  unsigned long m_WindowInstructions;  // instructions run in the current window
+  unsigned long m_WindowJitter;        // max lateness in the current window, up to PACER_SLACK_MICROSECONDS
+  unsigned long m_AchievedRate;        // instructions/second in the last window
+  unsigned long m_Jitter;              // max lateness (us) in the last window
+};
+
+extern Pacer pacer;
+
+#endif
@@ -0,0 +1,91 @@
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include "Profiler.h"
+
+#ifdef PROFILER_ENABLED
+
+void Profiler::Start()
+{
+  // a new run, start counting from 0
+  memset(this, 0, sizeof(Profiler));
+}
+
+void Profiler::Before(CPU* pCPU)
+{
+  // the CPU is about to execute an instruction
+  m_PC = pCPU->Read(REG_P_IDX);
+  byte Instruction = pCPU->Read(m_PC);
+  word Decoded = CPU::Decode(Instruction);
+  m_Class = DECODE_CLASS(Decoded);
+  m_NotTaken = (m_Class == CPU::eOpJump || m_Class == CPU::eOpJumpMark) &&
+               !CPU::JumpTaken(Decoded, pCPU->Read(DECODE_REG(Decoded)));
+  m_SysxItem = (Instruction == 0360)?(pCPU->Read(REG_A_IDX) & 0x7F):PROFILER_SYSX_ITEMS;
+  m_StartMicros = micros();
+}
+
+void Profiler::After(CPU* pCPU)
+{
+  // the instruction has executed, count it
+  if (m_SysxItem < PROFILER_SYSX_ITEMS)
+  {
+    m_pSysxCounts[m_SysxItem]++;
+    m_pSysxMicros[m_SysxItem] += micros() - m_StartMicros;
+  }
+  m_pClassCounts[m_Class]++;
+  if (m_NotTaken)
+    m_JumpsNotTaken++;
+  if (++m_pAddrCounts[m_PC] == 0xFF)
+  {
+    for (int Addr = 0; Addr < 256; Addr++)
+      m_pAddrCounts[Addr] >>= 1;
+    m_AddrHalvings++;
+  }
+}
+
+void Profiler::PrintClass(byte Class)
+{
+  for (byte Char = 0; Char < 4; Char++)
+    Serial.print((char)pgm_read_byte(CPU::s_ClassNames + Class * 4 + Char));
+}
+
+void Profiler::Report()
+{
+  // op-code classes (with the jumps not taken), SysInfo calls (index, count, microseconds) and 
+  // the relative executions of each address as 16 lines of 16, scaled by 2^halvings
+  Serial.println("[profile");
+  for (byte Class = CPU::eOpHalt; Class <= CPU::eOpStore; Class++)
+  {
+    PrintClass(Class);
+    Serial.print(' ');
+    Serial.print(m_pClassCounts[Class]);
+    if (Class == CPU::eOpJumpMark)
+    {
+      Serial.print(" not taken ");
+      Serial.print(m_JumpsNotTaken);
+    }
+    Serial.println();
+  }
+  for (byte Item = 0; Item < PROFILER_SYSX_ITEMS; Item++)
+  {
+    if (!m_pSysxCounts[Item])
+      continue;
+    Serial.print("SYSX 0");
+    Serial.print(Item, OCT);
+    Serial.print(' ');
+    Serial.print(m_pSysxCounts[Item]);
+    Serial.print(' ');
+    Serial.print(m_pSysxMicros[Item]);
+    Serial.println("us");
+  }
+  Serial.print("addresses x2^");
+  Serial.println(m_AddrHalvings);
+  for (int Addr = 0; Addr < 256; Addr++)
+  {
+    Serial.print(m_pAddrCounts[Addr]);
+    Serial.print((Addr % 16 == 15)?"\r\n":",");
+  }
+  Serial.println("]");
+}
+
+Profiler profiler = Profiler();
+#endif
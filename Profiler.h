@@ -0,0 +1,41 @@
+#ifndef profiler_h
+#define profiler_h
+
+// define to profile each run: executions per address, per op-code class and SysInfo calls, see Profiler::Report()
+// (costs ~500 bytes of RAM)
+//#define PROFILER_ENABLED
+#define PROFILER_SYSX_ITEMS 031   // SysInfo indexes profiled, see Config::tItems
+
+#ifdef PROFILER_ENABLED
+#include "CPU.h"
+
+// counts what the CPU executes, one instruction at a time
+class Profiler
+{
+public:
+  void Start();
+  void Before(CPU* pCPU);
+  void After(CPU* pCPU);
+  void Report();
+
+private:
+  void PrintClass(byte Class);
+
+  byte m_pAddrCounts[256];          // executions of the instruction at each address, all halved when one saturates
+  byte m_AddrHalvings;              // so each count is really (count << m_AddrHalvings)
+  unsigned long m_pClassCounts[CPU::eOpStore + 1];
+  unsigned long m_JumpsNotTaken;    // of the eOpJump & eOpJumpMark counted
+  word m_pSysxCounts[PROFILER_SYSX_ITEMS];
+  unsigned long m_pSysxMicros[PROFILER_SYSX_ITEMS];  // time spent in each SysInfo call
+
+  byte m_PC;                        // the instruction being executed
+  byte m_Class;
+  bool m_NotTaken;                  // a jump whose condition is false
+  byte m_SysxItem;
+  unsigned long m_StartMicros;
+};
+
+extern Profiler profiler;
+#endif
+
+#endif
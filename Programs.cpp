@@ -3,6 +3,11 @@
 #include "CPU.h"
 #include "Programs.h"
  
+// 1 to load the programs from PROGMEM images, 0 to assemble them from their source (below each image), e.g. to
+// change one (then update its image, e.g. load it and dump it with BitN+Disp).  Doing this frees up about 4k
+#define PROGRAMS_PROGMEM 1
+
+#if !PROGRAMS_PROGMEM
 // A really simple two-pass "assembler"
 
 #define pc(_a)      m_iIndex=_a;
@@ -56,7 +61,20 @@ byte* Programs::m_pMemory;
 byte  Programs::m_iIndex;
 byte  Programs::m_pLabels[32];
 byte  Programs::m_iPass;
+#endif
+
+#if PROGRAMS_PROGMEM
+const byte programSetRTC[] PROGMEM = 
+{
+  0000,0004,0034,0032,0134,0033,0023,0202,0124,0032,0360,0023,0201,0124,0033,0360,
+  0023,0200,0123,0000,0360,0000,0343,0004,0000,0000
+};
 
+void Programs::AssembleSetRTC(byte* pMem)
+{
+  memcpy_P(pMem + 0002, programSetRTC, sizeof(programSetRTC));
+}
+#else
 void Programs::AssembleSetRTC(byte* pMem)
 {
   m_pMemory = pMem;
@@ -91,6 +109,36 @@ void Programs::AssembleSetRTC(byte* pMem)
       equ(0)
   }
 }
+#endif
+
+#if PROGRAMS_PROGMEM
+const byte programCountClock[] PROGMEM = 
+{
+  0000,0000,0000,0004,0023,0377,0360,0272,0000,0300,0000,0023,0220,0123,0000,0360,
+  0023,0002,0360,0363,0204,0134,0237,0024,0237,0013,0014,0372,0000,0034,0237,0224,
+  0237,0026,0241,0034,0237,0023,0000,0034,0240,0363,0126,0023,0001,0360,0363,0204,
+  0134,0237,0223,0377,0203,0001,0113,0005,0372,0001,0343,0064,0302,0002,0343,0112,
+  0026,0255,0034,0237,0026,0256,0003,0200,0343,0120,0026,0256,0034,0237,0023,0200,
+  0034,0240,0363,0126,0343,0020,0300,0223,0005,0024,0237,0034,0200,0023,0222,0123,
+  0372,0360,0360,0024,0200,0004,0240,0034,0200,0023,0222,0360,0360,0024,0200,0014,
+  0240,0213,0001,0254,0126,0343,0133
+};
+
+// from 0204, after the flags
+const byte programCountClockHigh[] PROGMEM = 
+{
+  0300,0024,0001,0123,0000,0045,0223,0013,0020,0045,0231,0103,0012,0343,0213,0013,
+  0200,0103,0120,0343,0213,0003,0020,0104,0000,0353,0204,0000,0000,0277,0001,0003,
+  0007,0017,0037,0077,0201,0203,0207,0217,0237,0000,0000,0001,0001,0002,0003,0004,
+  0007,0010,0017,0020,0037,0040
+};
+
+void Programs::AssembleCountClock(byte* pMem)
+{
+  memcpy_P(pMem, programCountClock, sizeof(programCountClock));
+  memcpy_P(pMem + 0204, programCountClockHigh, sizeof(programCountClockHigh));
+}
+#else
 void Programs::AssembleCountClock(byte* pMem)
 {
   enum { ShowHr, Display, Blink, HrTab, DoBlink, BlinkLoop, MinLoop, MinTab10s, MinTab5s, SaveBlink, EvenX, BCD2Dec, BCDfix, BCDloop, BCDdone };
@@ -120,9 +168,8 @@ void Programs::AssembleCountClock(byte* pMem)
       op2(STBa, lbl(Display))         // B has hour
       op2(LDAa, lbl(Display))         // A has hour
       op2(SUAc, 12)                   // A -=12
-      op2(0272, REG_A_IDX)            // skip if b7 clear
-      op2(LDAa, lbl(Display))         // reload A (hr)
-      op2(STAa, lbl(Display))         // save A (hr)
+      op2(0372, REG_A_IDX)            // skip if b7 set (hr < 12, already saved)
+      op2(STAa, lbl(Display))         // save A (hr - 12)
       op2(LDXa, lbl(Display))         // X has hour
       op2(LDAx, lbl(HrTab))           // look up A
       op2(STAa, lbl(Display))         // save A (hr)
@@ -170,8 +217,7 @@ void Programs::AssembleCountClock(byte* pMem)
       op2(ADAa, lbl(Blink))           // add blink mask
       op2(STAa, REG_OUTPUT_IDX)       // Show it
       op2(LDAc, 128 + Config::eControlDelayMilliSec)
-      op2(LDBc, 250)	              // LDB #250
-      op1(SYSX)	                      // SYS sleep 250ms
+      op1(SYSX)	                      // SYS sleep 250ms (B still 250)
       op1(SYSX)	                      // SYS sleep 250ms
       op2(LDAa, REG_OUTPUT_IDX)       // reload A
       op2(SUAa, lbl(Blink))           // subtract blink mask
@@ -237,7 +283,37 @@ void Programs::AssembleCountClock(byte* pMem)
       equ(0040) // 55
  }
 }
+#endif
+
+#if PROGRAMS_PROGMEM
+const byte programBCDClock[] PROGMEM = 
+{
+  0000,0000,0000,0004,0023,0377,0360,0272,0000,0300,0000,0023,0220,0123,0000,0360,
+  0023,0002,0360,0363,0246,0134,0301,0024,0301,0013,0014,0372,0000,0034,0301,0224,
+  0301,0026,0305,0034,0301,0034,0303,0023,0000,0034,0304,0363,0127,0023,0001,0360,
+  0363,0204,0023,0200,0034,0304,0363,0127,0123,0144,0223,0010,0024,0301,0011,0034,
+  0301,0024,0303,0111,0034,0303,0323,0100,0004,0301,0034,0301,0034,0200,0023,0222,
+  0360,0213,0001,0243,0074,0343,0020,0300,0223,0005,0024,0301,0034,0200,0023,0222,
+  0123,0372,0360,0360,0024,0200,0004,0304,0034,0200,0023,0222,0360,0360,0024,0200,
+  0014,0304,0213,0001,0254,0127,0343,0134
+};
+
+// from 0204, after the flags
+const byte programBCDClockHigh[] PROGMEM = 
+{
+  0300,0134,0302,0123,0144,0223,0010,0024,0301,0211,0034,0301,0024,0302,0311,0034,
+  0302,0323,0001,0004,0301,0034,0301,0034,0200,0023,0222,0360,0213,0001,0243,0213,
+  0254,0204,0300,0024,0001,0123,0000,0045,0265,0013,0020,0045,0273,0103,0012,0343,
+  0255,0013,0200,0103,0120,0343,0255,0003,0020,0104,0000,0353,0246,0000,0000,0000,
+  0000,0022,0001,0002,0003,0004,0005,0006,0007,0010,0011,0020,0021
+};
 
+void Programs::AssembleBCDClock(byte* pMem)
+{
+  memcpy_P(pMem, programBCDClock, sizeof(programBCDClock));
+  memcpy_P(pMem + 0204, programBCDClockHigh, sizeof(programBCDClockHigh));
+}
+#else
 void Programs::AssembleBCDClock(byte* pMem)
 {
   enum { ShowHr, ScrollLeft, Left, Right, Display, Mins, Hours, Blink, HrBCDTab, DoBlink, BlinkLoop, BCD2Dec, BCDfix, BCDloop, BCDdone };
@@ -267,9 +343,8 @@ void Programs::AssembleBCDClock(byte* pMem)
       op2(STBa, lbl(Display))         // B has hour
       op2(LDAa, lbl(Display))         // A has hour
       op2(SUAc, 12)                   // A -=12
-      op2(0272, REG_A_IDX)            // skip if b7 clear
-      op2(LDAa, lbl(Display))         // reload A (hr)
-      op2(STAa, lbl(Display))         // save A (hr)
+      op2(0372, REG_A_IDX)            // skip if b7 set (hr < 12, already saved)
+      op2(STAa, lbl(Display))         // save A (hr - 12)
       op2(LDXa, lbl(Display))         // X has hour
       op2(LDAx, lbl(HrBCDTab))        // look up A as BCD
       op2(STAa, lbl(Display))         // save A (hr)
@@ -287,6 +362,7 @@ void Programs::AssembleBCDClock(byte* pMem)
       op2(STAa, lbl(Blink))           // save A (blink)
       op2(0363, lbl(DoBlink))
 
+      op2(LDBc, 100)                  // scroll delay, B isn't used in the loop
       op2(LDXc, 8)
     def(Right)
       // scroll right
@@ -301,7 +377,6 @@ void Programs::AssembleBCDClock(byte* pMem)
       op2(STAa, lbl(Display))
       op2(STAa, REG_OUTPUT_IDX)
       op2(LDAc, 128 + Config::eControlDelayMilliSec)
-      op2(LDBc, 100)
       op1(SYSX)	   // SYS sleep
       op2(SUXc, 1)
       op2(0243, lbl(Right))
@@ -322,8 +397,7 @@ void Programs::AssembleBCDClock(byte* pMem)
       op2(ADAa, lbl(Blink))           // add blink mask
       op2(STAa, REG_OUTPUT_IDX)       // Show it
       op2(LDAc, 128 + Config::eControlDelayMilliSec)
-      op2(LDBc, 250)	              // LDB #250
-      op1(SYSX)	                      // SYS sleep 250ms
+      op1(SYSX)	                      // SYS sleep 250ms (B still 250)
       op1(SYSX)	                      // SYS sleep 250ms
       op2(LDAa, REG_OUTPUT_IDX)       // reload A
       op2(SUAa, lbl(Blink))           // subtract blink mask
@@ -336,6 +410,7 @@ void Programs::AssembleBCDClock(byte* pMem)
     def(ScrollLeft)
       op1(0300)                       // NOOP: space for the return addr
       op2(STBa, lbl(Mins))         // B has mims
+      op2(LDBc, 100)                  // scroll delay, B isn't used in the loop
       op2(LDXc, 8)
     def(Left)
       // scroll left
@@ -350,7 +425,6 @@ void Programs::AssembleBCDClock(byte* pMem)
       op2(STAa, lbl(Display))
       op2(STAa, REG_OUTPUT_IDX)
       op2(LDAc, 128 + Config::eControlDelayMilliSec)
-      op2(LDBc, 100)
       op1(SYSX)	   // SYS sleep
       op2(SUXc, 1)
       op2(0243, lbl(Left))
@@ -400,7 +474,33 @@ void Programs::AssembleBCDClock(byte* pMem)
       equ(0x11) // 11
   }  
 }
+#endif
 
+#if PROGRAMS_PROGMEM
+const byte programBinClock[] PROGMEM = 
+{
+  0000,0000,0000,0004,0023,0377,0360,0272,0000,0300,0000,0023,0220,0123,0000,0360,
+  0023,0002,0360,0363,0204,0134,0237,0024,0237,0013,0014,0372,0000,0034,0237,0224,
+  0237,0026,0241,0034,0001,0023,0220,0360,0023,0001,0360,0363,0204,0134,0237,0023,
+  0200,0034,0240,0363,0067,0343,0020,0300,0223,0010,0024,0237,0034,0200,0023,0222,
+  0123,0372,0360,0360,0024,0200,0004,0240,0034,0200,0023,0222,0360,0360,0024,0200,
+  0014,0240,0213,0001,0254,0067,0343,0074
+};
+
+// from 0204, after the flags
+const byte programBinClockHigh[] PROGMEM = 
+{
+  0300,0024,0001,0123,0000,0045,0223,0013,0020,0045,0231,0103,0012,0343,0213,0013,
+  0200,0103,0120,0343,0213,0003,0020,0104,0000,0353,0204,0000,0000,0003,0010,0004,
+  0014,0002,0012,0006,0016,0001,0011,0005,0015
+};
+
+void Programs::AssembleBinClock(byte* pMem)
+{
+  memcpy_P(pMem, programBinClock, sizeof(programBinClock));
+  memcpy_P(pMem + 0204, programBinClockHigh, sizeof(programBinClockHigh));
+}
+#else
 void Programs::AssembleBinClock(byte* pMem)
 {
   enum { ShowHr, Display, Blink, HrBinTab, DoBlink, BlinkLoop, BCD2Dec, BCDfix, BCDloop, BCDdone };
@@ -430,9 +530,8 @@ void Programs::AssembleBinClock(byte* pMem)
       op2(STBa, lbl(Display))         // B has hour
       op2(LDAa, lbl(Display))         // A has hour
       op2(SUAc, 12)                   // A -=12
-      op2(0272, REG_A_IDX)            // skip if b7 clear
-      op2(LDAa, lbl(Display))         // reload A (hr)
-      op2(STAa, lbl(Display))         // save A (hr)
+      op2(0372, REG_A_IDX)            // skip if b7 set (hr < 12, already saved)
+      op2(STAa, lbl(Display))         // save A (hr - 12)
       op2(LDXa, lbl(Display))         // X has hour
       op2(LDAx, lbl(HrBinTab))        // look up A as binary
       op2(STAa, REG_B_IDX)
@@ -464,8 +563,7 @@ void Programs::AssembleBinClock(byte* pMem)
       op2(ADAa, lbl(Blink))           // add blink mask
       op2(STAa, REG_OUTPUT_IDX)       // Show it
       op2(LDAc, 128 + Config::eControlDelayMilliSec)
-      op2(LDBc, 250)	              // LDB #250
-      op1(SYSX)	                      // SYS sleep 250ms
+      op1(SYSX)	                      // SYS sleep 250ms (B still 250)
       op1(SYSX)	                      // SYS sleep 250ms
       op2(LDAa, REG_OUTPUT_IDX)       // reload A
       op2(SUAa, lbl(Blink))           // subtract blink mask
@@ -516,8 +614,23 @@ void Programs::AssembleBinClock(byte* pMem)
       equ(13) // 11
   }
 }
+#endif
 
 
+#if PROGRAMS_PROGMEM
+const byte programDBL[] PROGMEM = 
+{
+  0000,0000,0000,0004,0023,0220,0123,0000,0360,0023,0221,0123,0000,0360,0023,0021,
+  0360,0134,0002,0023,0021,0360,0134,0001,0134,0000,0323,0017,0034,0001,0023,0220,
+  0360,0023,0222,0123,0024,0360,0024,0001,0001,0034,0001,0023,0220,0360,0234,0200,
+  0023,0222,0123,0050,0360,0343,0016,0000
+};
+
+void Programs::AssembleDBL(byte* pMem)
+{
+  memcpy_P(pMem, programDBL, sizeof(programDBL));
+}
+#else
 void Programs::AssembleDBL(byte* pMem)
 {
   // Das Blinken Lights
@@ -571,9 +684,9 @@ void Programs::AssembleDBL(byte* pMem)
       equ(0)
   }
 }
+#endif
 
-#if 1
-// doing this frees up about 4k
+#if PROGRAMS_PROGMEM
 const byte programSieve[] PROGMEM = 
 {
   0000,0000,0000,0004,0034,0200,0223,0200,0023,0002,0363,0111,0203,0001,0023,0003,
@@ -0,0 +1,180 @@
+#include <Arduino.h>
+#include "Recorder.h"
+#include "CPU.h"
+#include "Config.h"
+
+#ifdef RECORDER_ENABLED
+Recorder::Recorder()
+{
+  m_Mode = eOff;
+}
+
+void Recorder::Record(CPU* pCPU)
+{
+  // start recording: the header, memory and EEPROM copy settings, then a record per input
+  Serial.write('K');
+  Serial.write('R');
+  Serial.write(pCPU->Memory(), 256);
+  Config::tState State;
+  config.SaveState(State);
+  Serial.write(State.m_EEPROMOffset);
+  Serial.write(State.m_RAMOffset);
+  Serial.write((byte)State.m_EEPROMSize);
+  Serial.write((byte)(State.m_EEPROMSize >> 8));
+  m_Instructions = m_LastInstructions = 0;
+  m_Mode = eRecording;
+}
+
+bool Recorder::Replay(CPU* pCPU)
+{
+  // start replaying a recording from Serial, false if there isn't one
+  byte Header;
+  do
+  {
+    if (!ReadByte(Header))
+      return false;
+  } while (Header != 'K');
+  if (!ReadByte(Header) || Header != 'R')
+    return false;
+  byte* pMemory = pCPU->Memory();
+  for (int Addr = 0; Addr < 256; Addr++)
+  {
+    if (!ReadByte(pMemory[Addr]))
+      return false;
+  }
+  Config::tState State;
+  byte Low;
+  byte High;
+  if (!ReadByte(State.m_EEPROMOffset) || !ReadByte(State.m_RAMOffset) || !ReadByte(Low) || !ReadByte(High))
+    return false;
+  State.m_EEPROMSize = word(High, Low);
+  config.RestoreState(State);
+  m_Instructions = m_NextInstructions = 0;
+  m_Mode = eReplaying;
+  ReadNext();
+  return true;
+}
+
+void Recorder::Stop()
+{
+  // the program has stopped, finish the recording
+  if (m_Mode == eRecording)
+    WriteRecord(RECORDER_SOURCE_END, 0);
+  m_Mode = eOff;
+}
+
+bool Recorder::Active()
+{
+  return m_Mode != eOff;
+}
+
+bool Recorder::Replaying()
+{
+  return m_Mode == eReplaying;
+}
+
+void Recorder::Count(word Instructions)
+{
+  // the CPU has executed some more
+  m_Instructions += Instructions;
+  if (m_Mode == eReplaying && m_NextSource == RECORDER_SOURCE_END && m_NextInstructions <= m_Instructions)
+    m_Mode = eOff;  // the recording has run out, carry on live
+}
+
+byte Recorder::Input(byte Source, byte Value)
+{
+  // the program has received Value from Source, returns the Value to use
+  if (m_Mode == eRecording)
+    WriteRecord(Source, Value);
+  else
+    Replayed(Source, Value);
+  return Value;
+}
+
+bool Recorder::Output(byte Source, byte Value)
+{
+  // the program has sent Value to Source (i.e. Serial, which is carrying the recording).  When recording it's
+  // recorded, when replaying it's checked against the recording.  False if it should go out for real
+  if (m_Mode == eRecording)
+  {
+    WriteRecord(Source, Value);
+    return true;
+  }
+  byte Recorded;
+  if (Replayed(Source, Recorded) && Recorded == Value)
+    return true;
+  m_Mode = eOff;  // not replaying, or a different value: the program has gone a different way
+  return false;
+}
+
+bool Recorder::Replayed(byte Source, byte& Value)
+{
+  // when replaying, true if the next record is from Source, now, and Value is the recorded value.  If it isn't
+  // the program has gone a different way than when it was recorded, give up and carry on live
+  if (m_Mode != eReplaying)
+    return false;
+  if (Due(Source, Value))
+    return true;
+  m_Mode = eOff;
+  return false;
+}
+
+bool Recorder::Due(byte Source, byte& Value)
+{
+  // when replaying, is the next record from Source, now?  If so Value is the recorded value
+  if (m_Mode != eReplaying || m_NextSource != Source || m_NextInstructions != m_Instructions)
+    return false;
+  Value = m_NextValue;
+  ReadNext();
+  return true;
+}
+
+bool Recorder::ReadByte(byte& Value)
+{
+  // the next byte from Serial, false if it doesn't arrive in time
+  unsigned long Start = millis();
+  while (Serial.available() <= 0)
+  {
+    if (millis() - Start > RECORDER_TIMEOUT_MILLISECONDS)
+      return false;
+  }
+  Value = Serial.read();
+  return true;
+}
+
+void Recorder::ReadNext()
+{
+  // read ahead the next record: source, instructions since the previous record (7 bits per byte, 
+  // least significant first, b7 set if more follow), value.  If it's incomplete it ends the recording
+  byte Byte = 0x80;
+  byte Shift = 0;
+  unsigned long Delta = 0;
+  bool Ok = ReadByte(m_NextSource);
+  while (Ok && (Byte & 0x80) && Shift < 32)
+  {
+    Ok = ReadByte(Byte);
+    Delta |= (unsigned long)(Byte & 0x7F) << Shift;
+    Shift += 7;
+  }
+  if (!Ok || !ReadByte(m_NextValue))
+    m_NextSource = RECORDER_SOURCE_END;
+  m_NextInstructions += Delta;
+}
+
+void Recorder::WriteRecord(byte Source, byte Value)
+{
+  // see ReadNext()
+  unsigned long Delta = m_Instructions - m_LastInstructions;
+  m_LastInstructions = m_Instructions;
+  Serial.write(Source);
+  while (Delta > 0x7F)
+  {
+    Serial.write((byte)(Delta | 0x80));
+    Delta >>= 7;
+  }
+  Serial.write((byte)Delta);
+  Serial.write(Value);
+}
+
+Recorder recorder = Recorder();
+#endif
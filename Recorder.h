@@ -0,0 +1,54 @@
+#ifndef recorder_h
+#define recorder_h
+
+// define to record everything a running program gets from outside the CPU (the Input register from the 
+// buttons, SysInfo clock, random & serial reads) to Serial, and to replay a recording.  See record.txt
+//#define RECORDER_ENABLED
+
+#define RECORDER_SOURCE_INPUT  0177   // a write to the Input register, other sources are the SysInfo A value
+#define RECORDER_SOURCE_END    0377   // the end of a recording
+#define RECORDER_TIMEOUT_MILLISECONDS 1000  // when replaying, how long to wait for the next byte
+
+#ifdef RECORDER_ENABLED
+class CPU;
+
+// records, or replays, a running program's inputs, tagged with the number of instructions executed
+class Recorder
+{
+public:
+  enum tMode
+  {
+    eOff,
+    eRecording,
+    eReplaying
+  };
+
+  Recorder();
+  void Record(CPU* pCPU);
+  bool Replay(CPU* pCPU);
+  void Stop();
+  bool Active();
+  bool Replaying();
+  void Count(word Instructions);
+  byte Input(byte Source, byte Value);
+  bool Output(byte Source, byte Value);
+  bool Replayed(byte Source, byte& Value);
+  bool Due(byte Source, byte& Value);
+
+private:
+  bool ReadByte(byte& Value);
+  void ReadNext();
+  void WriteRecord(byte Source, byte Value);
+
+  byte m_Mode;
+  unsigned long m_Instructions;       // executed since the recording started
+  unsigned long m_LastInstructions;   // when the previous record was written
+  byte m_NextSource;                  // when replaying, the next record
+  byte m_NextValue;
+  unsigned long m_NextInstructions;
+};
+
+extern Recorder recorder;
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#include <Arduino.h>
+#include "Tracer.h"
+#include "CPU.h"
+
+#ifdef TRACER_ENABLED
+Tracer::Tracer()
+{
+  m_bActive = false;
+  m_Head = m_Count = 0;
+}
+
+void Tracer::Start()
+{
+  // a new trace, the header then a record per instruction
+  m_Head = m_Count = 0;
+  m_bActive = true;
+  Serial.write('K');
+  Serial.write('T');
+}
+
+void Tracer::Stop()
+{
+  // the run has ended, send what's left
+  if (m_bActive)
+    Drain(true);
+  m_bActive = false;
+}
+
+bool Tracer::Active()
+{
+  return m_bActive;
+}
+
+byte Tracer::PackFlags(CPU* pCPU)
+{
+  // the carry & overflow flags of A, B & X in b1:0, b3:2 & b5:4
+  return (pCPU->Read(REG_FLAGS_A_IDX) & 0x03) | ((pCPU->Read(REG_FLAGS_B_IDX) & 0x03) << 2) | ((pCPU->Read(REG_FLAGS_X_IDX) & 0x03) << 4);
+}
+
+void Tracer::Before(CPU* pCPU)
+{
+  // the CPU is about to execute an instruction
+  m_Current.m_PC = pCPU->Read(REG_P_IDX);
+  m_Current.m_Instruction = pCPU->Read(m_Current.m_PC);
+  m_Current.m_Addr = pCPU->OperandAddr(m_Current.m_PC);
+  m_Current.m_Flags = PackFlags(pCPU);
+}
+
+void Tracer::After(CPU* pCPU)
+{
+  // the instruction has executed, record it.  If the ring is full wait for Serial
+  m_Current.m_Value = pCPU->Read(m_Current.m_Addr);
+  m_Current.m_Flags ^= PackFlags(pCPU);
+  if (m_Count == TRACER_RECORDS)
+    Send();
+  m_pRecords[(m_Head + m_Count) % TRACER_RECORDS] = m_Current;
+  m_Count++;
+}
+
+void Tracer::Drain(bool All)
+{
+  // send buffered records, only as many as Serial can take without waiting unless All
+  while (m_Count && (All || Serial.availableForWrite() >= (int)sizeof(tRecord)))
+    Send();
+}
+
+void Tracer::Send()
+{
+  // write the oldest record to Serial, waiting if necessary
+  Serial.write((const byte*)&m_pRecords[m_Head], sizeof(tRecord));
+  m_Head = (m_Head + 1) % TRACER_RECORDS;
+  m_Count--;
+}
+
+Tracer tracer = Tracer();
+#endif
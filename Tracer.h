@@ -0,0 +1,46 @@
+#ifndef tracer_h
+#define tracer_h
+
+// define to trace every instruction of a run to Serial, see trace.txt
+//#define TRACER_ENABLED
+#define TRACER_RECORDS 32   // records buffered, 5 bytes of RAM each
+
+#ifdef TRACER_ENABLED
+class CPU;
+
+// records each instruction executed into a ring, drained to Serial as it has room
+class Tracer
+{
+public:
+  Tracer();
+  void Start();
+  void Stop();
+  bool Active();
+  void Before(CPU* pCPU);
+  void After(CPU* pCPU);
+  void Drain(bool All);
+
+private:
+  byte PackFlags(CPU* pCPU);
+  void Send();
+
+  // packed, see trace.txt
+  struct tRecord
+  {
+    byte m_PC;
+    byte m_Instruction;
+    byte m_Addr;
+    byte m_Value;
+    byte m_Flags;
+  };
+  tRecord m_pRecords[TRACER_RECORDS];
+  byte m_Head;    // the next record to write to Serial
+  byte m_Count;   // records waiting
+  bool m_bActive;
+  tRecord m_Current;  // the instruction being executed
+};
+
+extern Tracer tracer;
+#endif
+
+#endif